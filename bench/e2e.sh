@@ -0,0 +1,61 @@
+#!/bin/sh
+# End-to-end throughput of a built shell: commands per second for single
+# commands, N-stage pipelines and script mode, all running /bin/true, plus
+# the bandwidth of a |> fan-out, globs over a 100k-entry directory, shell
+# function calls and a [ ... ] / $((...)) counting loop.
+# Output: "e2e <name> <units/s> <units>" lines, tab separated.
+
+SHELL_BIN=${1:-bin/myshell}
+N=${N:-2000}
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+now_ns() { date +%s%N; }
+
+# run <name> <script> <commands>: time the shell over a script file
+run() {
+    start=$(now_ns)
+    "$SHELL_BIN" "$2" > /dev/null || { echo "e2e: $1 failed" >&2; exit 1; }
+    end=$(now_ns)
+    awk -v n="$3" -v ns="$((end - start))" -v name="$1" \
+        'BEGIN { printf "e2e\t%s\t%.1f\t%d\n", name, n / (ns / 1e9), n }'
+}
+
+# one command per line
+i=0; : > "$TMP/single.sh"
+while [ $i -lt $N ]; do echo /bin/true >> "$TMP/single.sh"; i=$((i + 1)); done
+run single_true "$TMP/single.sh" $N
+
+# N-stage pipelines, counted as pipelines per second
+for stages in 2 4 8; do
+    line=/bin/true; s=1
+    while [ $s -lt $stages ]; do line="$line | /bin/true"; s=$((s + 1)); done
+    i=0; : > "$TMP/pipe$stages.sh"
+    while [ $i -lt $((N / stages)) ]; do echo "$line" >> "$TMP/pipe$stages.sh"; i=$((i + 1)); done
+    run "pipeline_${stages}" "$TMP/pipe$stages.sh" $((N / stages))
+done
+
+# script mode: a for loop parsed once and run N times
+i=0
+words=""
+while [ $i -lt $N ]; do words="$words $i"; i=$((i + 1)); done
+printf 'for w in%s; do /bin/true; done\n' "$words" > "$TMP/for.sh"
+run script_for_loop "$TMP/for.sh" $N
+
+# fan-out: a 256 MiB stream copied to two consumers, in MiB per second
+echo 'head -c 268435456 /dev/zero |> { cat > /dev/null ; cat > /dev/null }' > "$TMP/fanout.sh"
+run fanout_2_mib "$TMP/fanout.sh" 256
+
+# globbing a 100k-entry directory, in globs per second (listing cached after the first)
+mkdir "$TMP/glob" && (cd "$TMP/glob" && seq -f 'f%06g' 100000 | xargs touch)
+i=0; : > "$TMP/glob.sh"
+while [ $i -lt 200 ]; do echo "echo $TMP/glob/f*7 > /dev/null" >> "$TMP/glob.sh"; i=$((i + 1)); done
+run glob_100k "$TMP/glob.sh" 200
+
+# function calls: parsed once, run in the shell with a local and $1, in calls per second
+printf 'f() { local v=$1; }\nfor w in%s; do f $w; done\n' "$words" > "$TMP/func.sh"
+run function_calls "$TMP/func.sh" $N
+
+# a condition-heavy loop: [ and $((...)) in the shell, in iterations per second
+printf 'n=0\nwhile [ $n -lt %d ]; do n=$((n + 1)); done\n' $N > "$TMP/count.sh"
+run test_arith_loop "$TMP/count.sh" $N
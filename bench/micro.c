@@ -0,0 +1,170 @@
+#include "shell.h"
+#include <time.h>
+
+/*
+ * Microbenchmarks for the shell's internal hot paths, linked against the
+ * shell's own objects. Each result is one tab-separated line:
+ *
+ *     micro <name> <ns/op> <iterations>
+ *
+ * so bench_output.txt files from two builds can be diffed or joined.
+ */
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *name, double start, long iters) {
+    printf("micro\t%s\t%.1f\t%ld\n", name, (now_ns() - start) / iters, iters);
+}
+
+static void bench_parse(void) {
+    static const char *lines[] = {
+        "ls -l /tmp",
+        "cat < in.txt | grep -v foo | sort | uniq -c > out.txt",
+        "for f in a b c d; do if test -f $f; then echo \"$f exists\"; fi; done",
+    };
+    static const char *names[] = { "parse_simple", "parse_pipeline", "parse_compound" };
+    arena_t a;
+    arena_init(&a);
+    for (int k = 0; k < 3; ++k) {
+        long iters = 200000;
+        double t0 = now_ns();
+        for (long i = 0; i < iters; ++i) {
+            int err;
+            parse_segments(&a, lines[k], NULL, &err);
+            arena_reset(&a);
+        }
+        report(names[k], t0, iters);
+    }
+    arena_free(&a);
+}
+
+static void bench_expand(void) {
+    arena_t a;
+    arena_init(&a);
+    set_var("HOME", "/home/bench");
+    set_var("NAME", "value");
+    char *plain[] = { "grep", "-rn", "pattern", "src/", NULL };
+    char *vars[] = { "echo", "$HOME/x", "${NAME}_suffix", "\"quoted $NAME\"", "'single'", NULL };
+    long iters = 500000;
+
+    double t0 = now_ns();
+    for (long i = 0; i < iters; ++i) {
+        expand_argv(&a, plain, NULL);
+        arena_reset(&a);
+    }
+    report("expand_plain", t0, iters);
+
+    t0 = now_ns();
+    for (long i = 0; i < iters; ++i) {
+        expand_argv(&a, vars, NULL);
+        arena_reset(&a);
+    }
+    report("expand_vars", t0, iters);
+    arena_free(&a);
+}
+
+static void bench_vars(void) {
+    long nvars = 100000;
+    char name[32], value[32];
+    double t0 = now_ns();
+    for (long i = 0; i < nvars; ++i) {
+        snprintf(name, sizeof(name), "VAR_%ld", i);
+        snprintf(value, sizeof(value), "%ld", i);
+        set_var(name, value);
+    }
+    report("set_var_100k", t0, nvars);
+
+    long iters = 1000000;
+    t0 = now_ns();
+    for (long i = 0; i < iters; ++i) {
+        snprintf(name, sizeof(name), "VAR_%ld", (i * 7919) % nvars);
+        if (!get_var(name)) { fprintf(stderr, "get_var: %s missing\n", name); exit(1); }
+    }
+    report("get_var_100k", t0, iters);
+
+    t0 = now_ns();
+    for (long i = 0; i < iters; ++i) {
+        snprintf(name, sizeof(name), "VAR_%ld", i % nvars);
+        set_var(name, "x");
+    }
+    report("set_var_overwrite", t0, iters);
+}
+
+static void bench_history(void) {
+    setenv("HISTFILE", "", 1);      /* in memory only */
+    init_history();
+    long iters = 1000000;
+    double t0 = now_ns();
+    for (long i = 0; i < iters; ++i) add_history_cmd("git status --short && make -j8");
+    report("add_history_cmd", t0, iters);
+    free_history();
+
+    /* persistent: locked append to a history file, then a cold load of it */
+    char path[] = "/tmp/bench_histXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return;
+    close(fd);
+    setenv("HISTFILE", path, 1);
+    init_history();
+    iters = 100000;
+    t0 = now_ns();
+    for (long i = 0; i < iters; ++i) add_history_cmd("git status --short && make -j8");
+    report("add_history_cmd_file", t0, iters);
+    free_history();
+
+    t0 = now_ns();
+    init_history();
+    report("load_history_100k", t0, 1);
+    if (history_last() != iters) fprintf(stderr, "history: loaded %ld of %ld\n", history_last(), iters);
+    free_history();
+    unlink(path);
+}
+
+/* history_find over a million entries, indexed as they are added */
+static void bench_history_search(void) {
+    setenv("HISTFILE", "", 1);
+    setenv("HISTSIZE", "1000000", 1);
+    init_history();
+    static const char *verbs[] = { "git commit -m", "make -j8 target", "ssh host", "grep -rn pattern", "docker run image" };
+    char line[96];
+    long n = 1000000;
+    double t0 = now_ns();
+    for (long i = 0; i < n; ++i) {
+        snprintf(line, sizeof(line), "%s %ld", verbs[i % 5], i * 2654435761u % 1000003);
+        add_history_cmd(line);
+    }
+    report("history_index_build_1m", t0, 1);
+
+    t0 = now_ns();
+    history_find("ssh host", history_last() + 1);
+    report("history_find_first_1m", t0, 1);
+
+    long iters = 10000, hits = 0;
+    t0 = now_ns();
+    for (long i = 0; i < iters; ++i) hits += history_find("grep -rn", history_last() + 1 - i) != 0;
+    report("history_find_common_1m", t0, iters);
+
+    t0 = now_ns();
+    for (long i = 0; i < iters; ++i) {
+        snprintf(line, sizeof(line), "image %ld", i * 2654435761u % 1000003);
+        hits += history_find(line, history_last() + 1) != 0;
+    }
+    report("history_find_rare_1m", t0, iters);
+    if (!hits) fprintf(stderr, "history_find: no hits\n");
+    free_history();
+    unsetenv("HISTSIZE");
+}
+
+int main(void) {
+    bench_parse();
+    bench_expand();
+    bench_vars();
+    bench_history();
+    bench_history_search();
+    free_vars();
+    return 0;
+}
@@ -4,51 +4,259 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <time.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <ctype.h>
 
-#define MAX_LEN 512
-#define MAXARGS 10
-#define ARGLEN 30
 #define PROMPT "FCIT> "
 
+/* Arena API (per-command bump allocator) */
+typedef struct arena_block arena_block_t;
+typedef struct {
+    arena_block_t *head;
+} arena_t;
+
+typedef struct {
+    arena_block_t *block;
+    size_t used;
+} arena_mark_t;
+
+void arena_init(arena_t *a);
+void *arena_alloc(arena_t *a, size_t n);
+char *arena_strndup(arena_t *a, const char *s, size_t n);
+char *arena_strdup(arena_t *a, const char *s);
+void arena_reset(arena_t *a); /* frees everything at once */
+void arena_mark(arena_t *a, arena_mark_t *m);
+void arena_release(arena_t *a, const arena_mark_t *m); /* frees everything allocated since the mark */
+void arena_free(arena_t *a);
+
+/* Parsed command line (all memory owned by the parse arena) */
+enum { HERE_DOC, HERE_DOC_QUOTED, HERE_STRING };
+typedef struct {
+    int kind;           /* HERE_DOC_QUOTED: the delimiter was quoted, so no expansion */
+    char *text;         /* << body, every line newline-terminated; or the <<< word */
+} here_t;
+
+typedef struct {
+    char **argv;        /* NULL-terminated words; NULL when the stage has no words */
+    int argc;
+    char *infile;       /* '<' target, NULL if none */
+    char *outfile;      /* '>' target, NULL if none */
+    here_t *here;       /* '<<' / '<<<' input, NULL if none; replaces infile and the pipe */
+} stage_t;
+
+typedef struct pipeline_s {
+    stage_t *stages;
+    int nstages;
+    int background;             /* terminated by '&' */
+    char *text;                 /* source text, for job listings */
+    int timed;                  /* `time` prefix */
+    int memo;                   /* `memo` prefix: output served from the memo cache */
+    struct pipeline_s *fanout;  /* |> { ... }: consumers each fed a copy of the output */
+    int nfanout;
+} pipeline_t;
+
+/* AST node kinds */
+enum { NODE_PIPELINE, NODE_IF, NODE_WHILE, NODE_FOR, NODE_FUNCDEF };
+
+typedef struct node_s {
+    int type;
+    struct node_s *next;        /* next command of the enclosing list */
+    pipeline_t *pl;             /* NODE_PIPELINE */
+    struct node_s *cond;        /* NODE_IF / NODE_WHILE condition list */
+    struct node_s *body;        /* then-list / loop body / function body */
+    struct node_s *els;         /* else-list (an elif is a nested NODE_IF) */
+    int until;                  /* NODE_WHILE: loop while cond fails */
+    char *var;                  /* NODE_FOR loop variable / NODE_FUNCDEF name */
+    char **words;               /* NODE_FOR raw word list (NULL-terminated) */
+    int nwords;
+} node_t;
+
+/* Input API (terminal, script file, -c string or piped stdin) */
+typedef struct input_s input_t;
+input_t *input_open_tty(void);
+input_t *input_open_file(const char *path); /* NULL with errno set on failure */
+input_t *input_open_string(const char *s);
+input_t *input_open_fd(int fd);
+int input_interactive(const input_t *in);
+void input_close(input_t *in);
+
 /* Basic APIs */
-char* read_cmd(char* prompt, FILE* fp);
-char** tokenize(char* cmdline);
-int handle_builtin(char **arglist);
+char *read_cmd(input_t *in, const char *prompt); /* borrowed line, valid until the next call; NULL at EOF */
+/* Compile a line (plus continuation lines from `more` while a compound command is open);
+   NULL + *err=1 on syntax error */
+node_t *parse_segments(arena_t *a, const char *cmdline, input_t *more, int *err);
+const char *subst_end(const char *p); /* p at "$(" or "`": just past its end, NULL if unterminated */
+int handle_builtin(char **arglist, int *status, int in_fd, FILE *out); /* 1 if arglist was a builtin (status set) */
+int is_builtin(const char *name);
+const char *builtin_at(int i);   /* i-th builtin name, NULL past the end */
 
 /* Readline */
 void init_readline(void);
+void init_completion(void);     /* Tab: commands, $variables, else filenames */
+
+
+typedef struct job_s job_t;
+int execute_pipeline(const pipeline_t *pl); /* pl must already be expanded */
+job_t *launch_pipeline(const pipeline_t *pl, int mode, int out_fd); /* out_fd >= 0: last stage's stdout */
+int builtin_needs_subshell(char **argv, int piped_in); /* may not run inside the shell */
+int here_fd(const here_t *h);   /* memfd holding h's text, rewound; -1 on failure (reported) */
 
+/* Evaluator API (runs parsed AST nodes) */
+extern int last_status;     /* $? */
+int exec_list(arena_t *a, const node_t *list);
+int run_line(arena_t *a, const char *line, input_t *more);
+char *command_subst(arena_t *a, const char *cmd, size_t *len); /* $(cmd) output, trailing newlines trimmed */
+int exec_function(arena_t *a, const node_t *body); /* a function body: `return` ends it; returns its status */
 
-int execute_pipeline(char ***cmds_argv, char **infiles, char **outfiles, int ncmds, int background, const char *cmdline_for_job);
+/* Functions API (name() { list; } definitions, called inside the shell) */
+void define_function(const char *name, const node_t *body); /* body is copied */
+int is_function(const char *name);
+int call_function(arena_t *a, char **argv);    /* argv[0] names the function; returns its status */
 
-/* Jobs API (background job manager) */
+/* Stage controls API (pin/nice/sched/ulimit prefixes, applied between fork and exec) */
+#define CTL_MAX_CPUS 1024
+#define CTL_MAX_LIMITS 8
+typedef struct {
+    unsigned long cpus[CTL_MAX_CPUS / (8 * sizeof(unsigned long))];
+    int pinned;
+    int niced, nice;
+    int policy, priority;       /* policy -1: unchanged */
+    int nlimits;
+    struct { int resource; int unlimited; unsigned long long value; } limits[CTL_MAX_LIMITS];
+    char desc[128];             /* as `jobs -l` shows them */
+} stage_ctl_t;
+int stage_prefixed(char **argv);        /* argv starts with a control word and a command */
+int stage_controls(char **argv, stage_ctl_t *ctl); /* words consumed; -1 on a usage error (reported) */
+void apply_stage_ctl(const stage_ctl_t *ctl);      /* in the child; exits 126 on failure */
+int ulimit_builtin(char **argv, FILE *out);
+
+/* Spawn API (posix_spawn launch engine, fork fallback) */
+typedef struct {
+    char **argv;
+    const char *infile;     /* '<' file, used when in_fd < 0 */
+    const char *outfile;    /* '>' file, used when out_fd < 0 */
+    int in_fd;              /* pipe end to dup onto stdin, -1 if none */
+    int out_fd;             /* pipe end to dup onto stdout, -1 if none */
+    const int *close_fds;   /* fds the child must close after wiring */
+    int nclose;
+    int setpgid;            /* move the child into process group pgid */
+    pid_t pgid;             /* 0: a new group led by the child */
+    const stage_ctl_t *ctl; /* stage controls, NULL if none; forces the fork path */
+} spawn_req_t;
+
+pid_t spawn_process(const spawn_req_t *req); /* returns child pid, -1 on failure (already reported) */
+pid_t spawn_builtin(const spawn_req_t *req); /* builtin in a forked subshell */
+pid_t spawn_tee(const spawn_req_t *req, const int *outs, int nout); /* child copying its stdin to outs */
+int run_builtin(const spawn_req_t *req, int timed); /* builtin in the shell itself; returns its status */
+
+/* Command hash API (cached PATH lookups) */
+const char *hash_lookup(const char *cmd); /* borrowed absolute path, NULL if not on PATH */
+void hash_forget(const char *cmd);
+void hash_clear(void);
+void hash_print(FILE *out);
+int hash_builtin(char **argv, FILE *out);
+
+/* Jobs API (job table: every pipeline is one job with its own process group) */
+enum { JOB_FOREGROUND, JOB_BACKGROUND, JOB_OWNED };    /* owned: collected by the builtin that launched it */
 void init_jobs_table(void);
-void add_job(pid_t pid, const char *cmdline);
-void remove_job(pid_t pid);
-void print_jobs(void);
-void reap_background_jobs(void);
+void init_job_control(int interactive); /* interactive: process groups and terminal handoff */
+int job_control_enabled(void);
+void jobs_subshell(void);               /* in a forked copy of the shell: no job control */
+job_t *job_new(const char *cmdline, int nstages, int mode);
+pid_t job_spawn_pgid(const job_t *j);   /* group for the next stage: 0 until the leader is spawned */
+void job_add_pid(job_t *j, pid_t pid);  /* pid <= 0 records a stage that failed to start */
+void job_add_status(job_t *j, int status); /* a stage that already ran inside the shell */
+void job_set_ctl(job_t *j, const char *desc); /* stage controls of the stage added last */
+void job_launched(job_t *j);            /* announce a background job */
+void job_set_timed(job_t *j);           /* report per-stage rusage when it finishes */
+int timed_builtin(char **argv, int *status, int in_fd, FILE *out); /* handle_builtin() plus a `time` report */
+typedef struct {
+    struct timespec start;
+    struct rusage ru, children;
+} time_mark_t;                          /* where work done inside the shell under `time` began */
+void time_mark(time_mark_t *m);
+void time_report(const char *cmd, const time_mark_t *m); /* `time` row for the work since m */
+int job_wait(job_t *j);                 /* wait for each stage by pid; returns the job status */
+void print_jobs(FILE *out, int with_pids);
+int jobs_builtin(char **argv, int *status, FILE *out); /* jobs, fg, bg, wait, kill */
+void set_pipefail(int on);
+int get_pipefail(void);
+int reap_background_jobs(void); /* reaps exited children, reports background ones; returns count */
+int jobs_event_fd(void);        /* signalfd that becomes readable on SIGCHLD */
+int jobs_count(void);
+int jobs_reap(void);                    /* record exited children, report nothing */
+void jobs_wait_event(void);             /* block until a child changes state */
+int job_collect(job_t *j, int *status); /* owned job finished? frees it and sets *status */
+
+/* Parallel API (bounded-concurrency task runner) */
+int parallel_builtin(char **argv, int in_fd, FILE *out);
+
+/* Memo API (cached output of pipelines run with the `memo` prefix) */
+int memo_run(const pipeline_t *pl);     /* pl must already be expanded; returns its status */
+int memo_builtin(char **argv, FILE *out);
+
+/* Tee API (fan-out inside the kernel with tee(2)/splice(2)) */
+int tee_fds(int in, const int *outs, int nout, int vital); /* until EOF or outs[vital] loses its reader; 1 on failure */
+int tee_builtin(char **argv, int in_fd, FILE *out);
+
+/* Stats API (always-on hot-path counters and latency histograms) */
+enum { STAT_READ, STAT_LINE, STAT_PARSE, STAT_EXPAND, STAT_SPAWN, STAT_WAIT, STAT_NTIMERS };
+enum { CTR_LINES, CTR_PIPELINES, CTR_BUILTINS, CTR_SPAWNS, CTR_SPAWN_FAILS,
+       CTR_FORK_FALLBACK, CTR_NOT_FOUND, CTR_MEMO_HITS, STAT_NCOUNTERS };
+uint64_t stats_now(void);               /* monotonic ns */
+void stats_record(int timer, uint64_t start_ns);
+void stats_count(int counter);
+int stats_builtin(char **argv, FILE *out);
 
 /* Variables API */
 void set_var(const char *name, const char *value);
-char *get_var(const char *name); /* returns malloc'd string (caller frees); NULL if not set */
-void print_vars(void);
+const char *get_var(const char *name); /* borrowed, valid until the variable is next set; NULL if not set */
+void print_vars(FILE *out);
+void unset_var(const char *name);
+size_t var_count(void);
+unsigned long var_generation(void);     /* changes whenever a name is added or removed */
+const char *var_next(size_t *slot); /* iterate names: start with *slot = 0 */
 void free_vars(void);
-void expand_argv_inplace(char **argv); /* expands $VARNAME in argv array in-place */
+char **set_params(char **argv);  /* $0 $1 ...: argv is borrowed until replaced; returns the previous array */
+void push_locals(void);          /* enter a function: `local` saves into this scope */
+void pop_locals(void);           /* leave it: restore what `local` saved */
+int local_builtin(char **argv);
+/* The expansions return NULL when a $((...)) fails (already reported) */
+char *expand_word(arena_t *a, const char *word); /* quotes, $NAME and ${NAME} anywhere; result may borrow word */
+char *expand_heredoc(arena_t *a, const char *body); /* $ expansion only: quotes stay; may borrow body */
+char **expand_argv(arena_t *a, char **argv, int *argc); /* new array: $(...) may split a word */
+
+/* Arithmetic API ($((...)) integer expressions) */
+int arith_eval(const char *expr, long long *value); /* -1 on error (reported) */
+
+/* Test API (test / [ builtins) */
+int test_builtin(char **argv);  /* 0 true, 1 false, 2 malformed */
+
+/* Glob API (pathname expansion over cached getdents64 listings) */
+int glob_magic(const char *pat);        /* has an unquoted *, ? or closed [...] */
+char **glob_expand(arena_t *a, const char *pat, int *n); /* sorted matches, else pat unquoted; backslash quotes */
 
 /* history config */
-#define HISTORY_SIZE 50
+#define HISTORY_DEFAULT_SIZE 100000     /* entries kept in memory unless $HISTSIZE says otherwise */
 
-/* history API */
+/* history API (persistent, shared by concurrent shells) */
 void init_history(void);
 void free_history(void);
 void add_history_cmd(const char *cmd);
-void print_history(void);
-char *get_history_cmd_by_number(int n);
+void print_history(FILE *out, long last_n);        /* last_n <= 0: everything in memory */
+long history_first(void);               /* numbers currently held: first..last */
+long history_last(void);
+const char *history_at(long n, size_t *len);   /* borrowed, not NUL-terminated */
+char *get_history_cmd_by_number(long n);
+long history_find(const char *pat, long before); /* newest entry numbered < before containing pat; 0 if none */
+void hindex_add(long n, const char *s, size_t len);
+void hindex_clear(void);
 
 #endif // SHELL_H
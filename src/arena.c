@@ -0,0 +1,98 @@
+#include "shell.h"
+
+/*
+ * Bump allocator for everything that lives only as long as one command:
+ * parsed words, argv arrays, expanded strings. Nothing is freed
+ * individually; arena_reset() drops it all at once and keeps the first
+ * block around so the next command usually allocates no memory at all.
+ */
+
+#define ARENA_BLOCK_SIZE 8192
+#define ARENA_ALIGN 16
+
+struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t size;
+    _Alignas(ARENA_ALIGN) char data[];
+};
+
+void arena_init(arena_t *a) {
+    a->head = NULL;
+}
+
+static arena_block_t *new_block(size_t min) {
+    size_t size = min > ARENA_BLOCK_SIZE ? min : ARENA_BLOCK_SIZE;
+    arena_block_t *b = malloc(sizeof(arena_block_t) + size);
+    if (!b) { perror("malloc"); exit(1); }
+    b->next = NULL;
+    b->used = 0;
+    b->size = size;
+    return b;
+}
+
+void *arena_alloc(arena_t *a, size_t n) {
+    n = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    arena_block_t *b = a->head;
+    if (!b || b->size - b->used < n) {
+        b = new_block(n);
+        b->next = a->head;
+        a->head = b;
+    }
+    void *p = b->data + b->used;
+    b->used += n;
+    return p;
+}
+
+char *arena_strndup(arena_t *a, const char *s, size_t n) {
+    char *p = arena_alloc(a, n + 1);
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+char *arena_strdup(arena_t *a, const char *s) {
+    return arena_strndup(a, s, strlen(s));
+}
+
+/* Release every allocation; the oldest block is kept for reuse */
+void arena_reset(arena_t *a) {
+    arena_block_t *b = a->head;
+    if (!b) return;
+    while (b->next) {
+        arena_block_t *next = b->next;
+        free(b);
+        b = next;
+    }
+    b->used = 0;
+    a->head = b;
+}
+
+void arena_mark(arena_t *a, arena_mark_t *m) {
+    m->block = a->head;
+    m->used = a->head ? a->head->used : 0;
+}
+
+/* Pop back to a mark: blocks added since are freed, the marked block is rewound */
+void arena_release(arena_t *a, const arena_mark_t *m) {
+    if (!m->block) {
+        arena_reset(a);
+        return;
+    }
+    while (a->head != m->block) {
+        arena_block_t *next = a->head->next;
+        free(a->head);
+        a->head = next;
+    }
+    a->head->used = m->used;
+}
+
+void arena_free(arena_t *a) {
+    arena_block_t *b = a->head;
+    while (b) {
+        arena_block_t *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head = NULL;
+}
@@ -0,0 +1,240 @@
+#include "shell.h"
+#include <limits.h>
+
+/*
+ * $((...)) integer arithmetic, evaluated in the shell: `i=$((i + 1))` in
+ * a loop no longer needs an expr process per iteration.
+ *
+ * 64-bit signed integers with C's operators and precedence, plus **:
+ *
+ *   ( )   + - ! ~ (unary)   **   * / %   + -   << >>   < <= > >=
+ *   == !=   &   ^   |   &&   ||   ?:   = += -= *= /= %= <<= >>= &= ^= |=
+ *
+ * Numbers are decimal, 0x hex or 0 octal. A bare NAME reads the variable
+ * (unset or empty is 0); assignments set it. $ references and $(...) have
+ * already been expanded by the caller. && || and ?: evaluate only the side
+ * they need, so `$((n && 10 / n))` does not divide by zero.
+ */
+
+typedef struct {
+    const char *s;      /* the whole expression, for messages */
+    const char *p;
+    int noeval;         /* > 0: inside a branch that is not taken */
+    int err;
+} arith_t;
+
+static void arith_error(arith_t *x, const char *what) {
+    if (!x->err) fprintf(stderr, "arithmetic: %s: %s\n", x->s, what);
+    x->err = 1;
+}
+
+static void skip_blanks(arith_t *x) {
+    while (isspace((unsigned char)*x->p)) x->p++;
+}
+
+static long long ternary(arith_t *x);
+
+/* Binary operators, longest first so "<<" is not read as "<" */
+static const struct { const char *op; int prec; } binops[] = {
+    { "**", 12 }, { "<<", 9 }, { ">>", 9 }, { "<=", 8 }, { ">=", 8 }, { "==", 7 }, { "!=", 7 },
+    { "&&", 3 }, { "||", 2 }, { "*", 11 }, { "/", 11 }, { "%", 11 }, { "+", 10 }, { "-", 10 },
+    { "<", 8 }, { ">", 8 }, { "&", 6 }, { "^", 5 }, { "|", 4 }, { NULL, 0 }
+};
+
+/* Does binops[i] have an OP= assignment form? Not the logical, comparison or ** ones */
+static int assignable(int i) {
+    int prec = binops[i].prec;
+    return prec >= 4 && prec != 7 && prec != 8 && prec != 12;
+}
+
+/* Index in binops of the operator at p, -1 if none (an assignment such as += is not one) */
+static int binop_at(const char *p) {
+    for (int i = 0; binops[i].op; ++i) {
+        size_t n = strlen(binops[i].op);
+        if (strncmp(p, binops[i].op, n) != 0) continue;
+        return p[n] == '=' && assignable(i) ? -1 : i;
+    }
+    return -1;
+}
+
+static long long apply(arith_t *x, const char *op, long long l, long long r) {
+    if ((op[0] == '/' || op[0] == '%') && r == 0) {
+        if (!x->noeval) arith_error(x, "division by zero");
+        return 0;
+    }
+    /* + - * and ** wrap around on overflow, as the hardware does */
+    unsigned long long ul = l, ur = r;
+    switch (op[0]) {
+    case '*':
+        if (op[1] != '*') return (long long)(ul * ur);
+        if (r < 0) { if (!x->noeval) arith_error(x, "exponent less than 0"); return 0; }
+        {
+            unsigned long long v = 1;
+            for (; ur; ur >>= 1, ul *= ul) {    /* by squaring */
+                if (ur & 1) v *= ul;
+            }
+            return (long long)v;
+        }
+    case '/': return l == LLONG_MIN && r == -1 ? l : l / r;
+    case '%': return r == -1 ? 0 : l % r;
+    case '+': return (long long)(ul + ur);
+    case '-': return (long long)(ul - ur);
+    case '<':
+        if (op[1] == '<') return (long long)(ul << (r & 63));
+        return op[1] == '=' ? l <= r : l < r;
+    case '>':
+        if (op[1] == '>') return l >> (r & 63);
+        return op[1] == '=' ? l >= r : l > r;
+    case '=': return l == r;
+    case '!': return l != r;
+    case '&': return op[1] == '&' ? l && r : l & r;
+    case '^': return l ^ r;
+    case '|': return op[1] == '|' ? l || r : l | r;
+    }
+    return 0;
+}
+
+/* The value of variable name[0..n): unset or empty is 0 */
+static long long variable(arith_t *x, const char *name, size_t n) {
+    char buf[256];
+    if (n >= sizeof(buf)) { arith_error(x, "name too long"); return 0; }
+    memcpy(buf, name, n);
+    buf[n] = '\0';
+    const char *v = get_var(buf);
+    if (!v) return 0;
+    while (isspace((unsigned char)*v)) v++;
+    if (!*v) return 0;
+    char *end;
+    long long r = strtoll(v, &end, 0);
+    while (isspace((unsigned char)*end)) end++;
+    if (*end && !x->noeval) {
+        fprintf(stderr, "arithmetic: %s: %s: not an integer\n", buf, v);
+        x->err = 1;
+    }
+    return r;
+}
+
+/* NAME, NAME op= EXPR, a number or ( EXPR ) */
+static long long primary(arith_t *x) {
+    skip_blanks(x);
+    const char *p = x->p;
+    if (*p == '(') {
+        x->p++;
+        long long v = ternary(x);
+        skip_blanks(x);
+        if (*x->p != ')') { arith_error(x, "')' expected"); return 0; }
+        x->p++;
+        return v;
+    }
+    if (isdigit((unsigned char)*p)) {
+        char *end;
+        errno = 0;
+        long long v = strtoll(p, &end, 0);
+        if (errno || isalnum((unsigned char)*end) || *end == '_') arith_error(x, "invalid number");
+        x->p = end;
+        return v;
+    }
+    if (!(isalpha((unsigned char)*p) || *p == '_')) {
+        arith_error(x, *p ? "syntax error: operand expected" : "syntax error: expression expected");
+        return 0;
+    }
+    const char *name = p;
+    while (isalnum((unsigned char)*p) || *p == '_') p++;
+    size_t n = p - name;
+    x->p = p;
+    skip_blanks(x);
+
+    /* assignment: =, or a binary operator (not a comparison) followed by = */
+    const char *op = NULL;
+    if (x->p[0] == '=' && x->p[1] != '=') {
+        op = "=";
+        x->p++;
+    } else {
+        for (int i = 0; binops[i].op && !op; ++i) {
+            size_t k = strlen(binops[i].op);
+            if (assignable(i) && strncmp(x->p, binops[i].op, k) == 0 && x->p[k] == '=') {
+                op = binops[i].op;
+                x->p += k + 1;
+            }
+        }
+    }
+    if (!op) return variable(x, name, n);
+    long long r = ternary(x);
+    if (op[0] != '=') r = apply(x, op, variable(x, name, n), r);
+    if (!x->err && !x->noeval) {
+        char nm[256], num[32];
+        snprintf(nm, sizeof(nm), "%.*s", (int)n, name);
+        snprintf(num, sizeof(num), "%lld", r);
+        set_var(nm, num);
+    }
+    return r;
+}
+
+static long long unary(arith_t *x) {
+    skip_blanks(x);
+    char c = *x->p;
+    if ((c == '+' || c == '-') && x->p[1] != c) {
+        x->p++;
+        long long v = unary(x);
+        return c == '-' ? (long long)(0ULL - (unsigned long long)v) : v;
+    }
+    if (c == '!' && x->p[1] != '=') {
+        x->p++;
+        return !unary(x);
+    }
+    if (c == '~') {
+        x->p++;
+        return ~unary(x);
+    }
+    return primary(x);
+}
+
+/* Operators of precedence min_prec and up, by precedence climbing */
+static long long binary(arith_t *x, int min_prec) {
+    long long l = unary(x);
+    while (!x->err) {
+        skip_blanks(x);
+        int i = binop_at(x->p);
+        if (i < 0 || binops[i].prec < min_prec) break;
+        const char *op = binops[i].op;
+        int prec = binops[i].prec;
+        x->p += strlen(op);
+        /* && and || skip their right side once the left decides */
+        int skip = (op[0] == '&' && op[1] == '&' && !l) || (op[0] == '|' && op[1] == '|' && l);
+        x->noeval += skip;
+        long long r = binary(x, prec == 12 ? prec : prec + 1);  /* ** is right-associative */
+        x->noeval -= skip;
+        l = apply(x, op, l, r);
+    }
+    return l;
+}
+
+static long long ternary(arith_t *x) {
+    long long c = binary(x, 2);
+    skip_blanks(x);
+    if (x->err || *x->p != '?') return c;
+    x->p++;
+    x->noeval += !c;
+    long long t = ternary(x);
+    x->noeval -= !c;
+    skip_blanks(x);
+    if (*x->p != ':') { arith_error(x, "':' expected"); return 0; }
+    x->p++;
+    x->noeval += !!c;
+    long long f = ternary(x);
+    x->noeval -= !!c;
+    return c ? t : f;
+}
+
+int arith_eval(const char *expr, long long *value) {
+    arith_t x = { .s = expr, .p = expr };
+    skip_blanks(&x);
+    *value = 0;
+    if (!*x.p) return 0;    /* $(( )) is 0 */
+    long long v = ternary(&x);
+    skip_blanks(&x);
+    if (!x.err && *x.p) arith_error(&x, "syntax error in expression");
+    if (x.err) return -1;
+    *value = v;
+    return 0;
+}
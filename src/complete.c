@@ -0,0 +1,313 @@
+#include "shell.h"
+#include <dirent.h>
+#include <sys/stat.h>
+#include <readline/readline.h>
+
+/*
+ * Tab completion.
+ *
+ * Command names come from a prefix trie holding the builtins and every
+ * executable on $PATH; variable names ($NA<Tab>) from a second trie over
+ * the variable store. Both are built the first time they are needed. A
+ * completion then walks the prefix and lists the subtree below it, so a
+ * PATH with thousands of commands costs one stat(2) per directory instead
+ * of a rescan.
+ *
+ * Every name is reference-counted by the sources that provide it (a
+ * builtin, each PATH directory holding it), and every node counts the live
+ * names below it. When a directory's mtime changes only that directory is
+ * read again: its old names are released and the new ones added, and dead
+ * branches are skipped by their count instead of being freed. A new $PATH
+ * rebuilds the command trie. The variable trie is rebuilt when a name has
+ * been added or removed (`local` can do both) since it was last looked at.
+ *
+ * Anything else -- arguments, words containing a '/' -- falls through to
+ * readline's filename completion.
+ */
+
+typedef struct {
+    int child;          /* first child, -1 if none; siblings are sorted by c */
+    int sibling;
+    int refs;           /* sources providing the name ending here */
+    int live;           /* names with refs > 0 in this subtree */
+    char c;
+} trie_node_t;
+
+typedef struct {
+    trie_node_t *nodes;     /* nodes[0] is the root */
+    int used;
+    int cap;
+} trie_t;
+
+typedef struct {
+    char *dir;
+    struct timespec mtime;
+    char *names;        /* the executables found, NUL-separated */
+    size_t len;
+} comp_dir_t;
+
+static trie_t commands;
+static trie_t variables;
+static unsigned long vars_seen;     /* var_generation() the variable trie was built at */
+
+static char *path_snapshot = NULL;  /* $PATH the command trie was built from */
+static comp_dir_t *dirs = NULL;
+static int ndirs = 0;
+
+static int trie_node(trie_t *t, char c) {
+    if (t->used == t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 1024;
+        t->nodes = realloc(t->nodes, sizeof(trie_node_t) * t->cap);
+    }
+    trie_node_t *n = &t->nodes[t->used];
+    n->child = n->sibling = -1;
+    n->refs = n->live = 0;
+    n->c = c;
+    return t->used++;
+}
+
+static void trie_reset(trie_t *t) {
+    t->used = 0;
+    trie_node(t, '\0');
+}
+
+/* Child of node labelled c, created in sorted position when create is set; -1 if absent */
+static int trie_step(trie_t *t, int node, char c, int create) {
+    int prev = -1, k = t->nodes[node].child;
+    while (k >= 0 && t->nodes[k].c < c) {
+        prev = k;
+        k = t->nodes[k].sibling;
+    }
+    if (k >= 0 && t->nodes[k].c == c) return k;
+    if (!create) return -1;
+    int n = trie_node(t, c);    /* may move t->nodes */
+    t->nodes[n].sibling = k;
+    if (prev < 0) t->nodes[node].child = n;
+    else t->nodes[prev].sibling = n;
+    return n;
+}
+
+/* Add (delta 1) or release (delta -1) one reference to name */
+static void trie_ref(trie_t *t, const char *name, int delta) {
+    if (!t->cap) trie_reset(t);
+    int path[256], depth = 0, node = 0;
+    path[depth++] = 0;
+    for (const char *p = name; *p; ++p) {
+        if (depth == (int)(sizeof(path) / sizeof(path[0]))) return;   /* absurdly long: skip */
+        node = trie_step(t, node, *p, delta > 0);
+        if (node < 0) return;
+        path[depth++] = node;
+    }
+    trie_node_t *end = &t->nodes[node];
+    int was = end->refs > 0;
+    end->refs += delta;
+    int now = end->refs > 0;
+    if (was != now) {
+        for (int i = 0; i < depth; ++i) t->nodes[path[i]].live += now - was;
+    }
+}
+
+typedef struct {
+    char **v;
+    int n, cap;
+    char buf[256];
+    const char *lead;   /* prepended to every match ("$" for variables) */
+} matches_t;
+
+/* Append lead + buf[0..len) */
+static void add_match(matches_t *m, size_t len) {
+    if (m->n + 1 >= m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 64;
+        m->v = realloc(m->v, sizeof(char *) * m->cap);
+    }
+    size_t ll = strlen(m->lead);
+    char *s = malloc(ll + len + 1);
+    memcpy(s, m->lead, ll);
+    memcpy(s + ll, m->buf, len);
+    s[ll + len] = '\0';
+    m->v[m->n++] = s;
+}
+
+static void collect(const trie_t *t, int node, size_t depth, matches_t *m) {
+    for (int k = t->nodes[node].child; k >= 0; k = t->nodes[k].sibling) {
+        const trie_node_t *n = &t->nodes[k];
+        if (n->live == 0 || depth + 1 >= sizeof(m->buf)) continue;
+        m->buf[depth] = n->c;
+        if (n->refs > 0) add_match(m, depth + 1);
+        collect(t, k, depth + 1, m);
+    }
+}
+
+/* Every live name starting with prefix, in sorted order */
+static void trie_matches(trie_t *t, const char *prefix, matches_t *m) {
+    size_t plen = strlen(prefix);
+    if (!t->cap || plen >= sizeof(m->buf)) return;
+    int node = 0;
+    for (const char *p = prefix; *p && node >= 0; ++p) node = trie_step(t, node, *p, 0);
+    if (node < 0 || t->nodes[node].live == 0) return;
+    memcpy(m->buf, prefix, plen);
+    if (plen && t->nodes[node].refs > 0) add_match(m, plen);
+    collect(t, node, plen, m);
+}
+
+/* Release the names a directory provided */
+static void dir_release(comp_dir_t *d) {
+    for (size_t off = 0; off < d->len; off += strlen(d->names + off) + 1)
+        trie_ref(&commands, d->names + off, -1);
+    free(d->names);
+    d->names = NULL;
+    d->len = 0;
+}
+
+/* Read a directory's executables into d->names and reference them */
+static void dir_scan(comp_dir_t *d) {
+    struct stat st;
+    if (stat(d->dir, &st) == 0) d->mtime = st.st_mtim;
+    else d->mtime.tv_sec = d->mtime.tv_nsec = 0;
+
+    DIR *dp = opendir(d->dir);
+    if (!dp) return;
+    size_t cap = 4096;
+    d->names = malloc(cap);
+    struct dirent *e;
+    while ((e = readdir(dp)) != NULL) {
+        if (e->d_name[0] == '.' || e->d_type == DT_DIR) continue;
+        /* a link or an unknown type might still be a directory */
+        if (e->d_type != DT_REG && (fstatat(dirfd(dp), e->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode)))
+            continue;
+        if (faccessat(dirfd(dp), e->d_name, X_OK, 0) != 0) continue;
+        size_t n = strlen(e->d_name) + 1;
+        while (d->len + n > cap) d->names = realloc(d->names, cap *= 2);
+        memcpy(d->names + d->len, e->d_name, n);
+        d->len += n;
+        trie_ref(&commands, e->d_name, 1);
+    }
+    closedir(dp);
+}
+
+static void free_dirs(void) {
+    for (int i = 0; i < ndirs; ++i) {
+        free(dirs[i].dir);
+        free(dirs[i].names);
+    }
+    free(dirs);
+    dirs = NULL;
+    ndirs = 0;
+    free(path_snapshot);
+    path_snapshot = NULL;
+}
+
+/* Build the command trie for $PATH, or bring it up to date with its directories */
+static void refresh_commands(void) {
+    const char *path = get_var("PATH");
+    if (!path) path = getenv("PATH");
+    if (!path) path = "/usr/local/bin:/usr/bin:/bin";
+
+    if (path_snapshot && strcmp(path, path_snapshot) == 0) {
+        for (int i = 0; i < ndirs; ++i) {
+            struct stat st;
+            if (stat(dirs[i].dir, &st) != 0) st.st_mtim.tv_sec = st.st_mtim.tv_nsec = 0;
+            if (st.st_mtim.tv_sec == dirs[i].mtime.tv_sec && st.st_mtim.tv_nsec == dirs[i].mtime.tv_nsec)
+                continue;
+            dir_release(&dirs[i]);
+            dir_scan(&dirs[i]);
+        }
+        return;
+    }
+
+    free_dirs();
+    trie_reset(&commands);
+    for (int i = 0; builtin_at(i); ++i) trie_ref(&commands, builtin_at(i), 1);
+    path_snapshot = strdup(path);
+    int cap = 8;
+    dirs = malloc(sizeof(comp_dir_t) * cap);
+    const char *p = path;
+    while (1) {
+        const char *colon = strchr(p, ':');
+        size_t len = colon ? (size_t)(colon - p) : strlen(p);
+        if (ndirs == cap) dirs = realloc(dirs, sizeof(comp_dir_t) * (cap *= 2));
+        comp_dir_t *d = &dirs[ndirs++];
+        /* an empty PATH element means the current directory */
+        d->dir = len ? strndup(p, len) : strdup(".");
+        d->names = NULL;
+        d->len = 0;
+        dir_scan(d);
+        if (!colon) break;
+        p = colon + 1;
+    }
+}
+
+static void refresh_variables(void) {
+    if (var_generation() == vars_seen) return;
+    size_t slot = 0;
+    const char *name;
+    trie_reset(&variables);
+    while ((name = var_next(&slot)) != NULL) trie_ref(&variables, name, 1);
+    vars_seen = var_generation();
+}
+
+/* Does the word starting at start name a command? */
+static int command_position(int start) {
+    const char *line = rl_line_buffer;
+    int i = start;
+    while (i > 0 && (line[i - 1] == ' ' || line[i - 1] == '\t')) i--;
+    if (i == 0 || strchr("|;&({`>", line[i - 1])) {
+        /* `cmd >`: the word after a redirection is a file */
+        return i == 0 || line[i - 1] != '>' || (i >= 2 && line[i - 2] == '|');
+    }
+    /* the previous word is a keyword that a command follows */
+    static const char *const keywords[] = { "then", "do", "else", "elif", "if", "while", "until", "!", NULL };
+    int end = i;
+    while (i > 0 && line[i - 1] != ' ' && line[i - 1] != '\t') i--;
+    for (int k = 0; keywords[k]; ++k) {
+        size_t n = strlen(keywords[k]);
+        if ((size_t)(end - i) == n && strncmp(line + i, keywords[k], n) == 0)
+            return i == 0 || command_position(i);
+    }
+    return 0;
+}
+
+static matches_t pending;   /* the matches handed out by next_match() */
+static int pending_next;
+
+static char *next_match(const char *text, int state) {
+    (void)text;
+    if (state == 0) pending_next = 0;
+    if (pending_next < pending.n) return pending.v[pending_next++];
+    free(pending.v);
+    memset(&pending, 0, sizeof(pending));
+    return NULL;
+}
+
+static char **shell_completion(const char *text, int start, int end) {
+    (void)end;
+    memset(&pending, 0, sizeof(pending));
+    if (text[0] == '$') {
+        refresh_variables();
+        pending.lead = "$";
+        trie_matches(&variables, text + 1, &pending);
+    } else if (start >= 2 && rl_line_buffer[start - 1] == '{' && rl_line_buffer[start - 2] == '$') {
+        refresh_variables();
+        pending.lead = "";
+        trie_matches(&variables, text, &pending);
+        rl_completion_append_character = '}';
+    } else if (!strchr(text, '/') && command_position(start)) {
+        refresh_commands();
+        pending.lead = "";
+        trie_matches(&commands, text, &pending);
+    } else {
+        return NULL;    /* readline's filename completion */
+    }
+    rl_attempted_completion_over = 1;
+    if (pending.n == 0) {
+        free(pending.v);
+        return NULL;
+    }
+    return rl_completion_matches(text, next_match);
+}
+
+void init_completion(void) {
+    rl_attempted_completion_function = shell_completion;
+    /* '$' stays in the word so variables can be told apart */
+    rl_completer_word_break_characters = " \t\n\"'`@><=;|&{(";
+}
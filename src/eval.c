@@ -0,0 +1,416 @@
+#define _GNU_SOURCE     /* memfd_create */
+#include "shell.h"
+#include <sys/mman.h>
+#include <ctype.h>
+
+/*
+ * Evaluator: walks the AST built by parse_segments(). Parsed words are
+ * never modified; each run expands them into scratch memory that is
+ * released as soon as the pipeline finishes, so a loop body costs the same
+ * on its 10,000th iteration as on its first.
+ */
+
+int last_status = 0;
+
+static int loop_depth = 0;      /* loops currently executing */
+static int break_levels = 0;    /* pending `break N` */
+static int continue_levels = 0; /* pending `continue N` */
+static int func_depth = 0;      /* function bodies currently executing */
+static int returning = 0;       /* pending `return` */
+static int return_status = 0;
+
+/* a break, continue or return is unwinding: stop running commands */
+#define UNWINDING() (break_levels || continue_levels || returning)
+
+/* NAME=value word? Sets name and raw value on success */
+static int detect_assignment(arena_t *a, const char *w, char **name_out, const char **value_out) {
+    const char *eq = strchr(w, '=');
+    if (!eq || eq == w) return 0;
+    /* name must be a plain identifier (no quotes or expansions) */
+    if (!(isalpha((unsigned char)w[0]) || w[0] == '_')) return 0;
+    for (const char *p = w; p < eq; ++p) {
+        if (!(isalnum((unsigned char)*p) || *p == '_')) return 0;
+    }
+    *name_out = arena_strndup(a, w, eq - w);
+    *value_out = eq + 1;
+    return 1;
+}
+
+/* Copy a parsed pipeline with every word expanded, leaving the parse untouched.
+   NULL if an expansion failed (reported): nothing of it may run */
+static pipeline_t *expand_pipeline(arena_t *a, const pipeline_t *raw) {
+    pipeline_t *pl = arena_alloc(a, sizeof(pipeline_t));
+    *pl = *raw;
+    pl->stages = arena_alloc(a, sizeof(stage_t) * raw->nstages);
+    for (int i = 0; i < raw->nstages; ++i) {
+        stage_t *s = &pl->stages[i];
+        *s = raw->stages[i];
+        if (s->argv && !(s->argv = expand_argv(a, raw->stages[i].argv, &s->argc))) return NULL;
+        if (s->infile && !(s->infile = expand_word(a, s->infile))) return NULL;
+        if (s->outfile && !(s->outfile = expand_word(a, s->outfile))) return NULL;
+        if (s->here && s->here->kind != HERE_DOC_QUOTED) {
+            here_t *h = arena_alloc(a, sizeof(here_t));
+            h->kind = s->here->kind;
+            h->text = h->kind == HERE_STRING ? expand_word(a, s->here->text) : expand_heredoc(a, s->here->text);
+            if (!h->text) return NULL;
+            s->here = h;
+        }
+    }
+    if (raw->nfanout) {
+        pl->fanout = arena_alloc(a, sizeof(pipeline_t) * raw->nfanout);
+        for (int k = 0; k < raw->nfanout; ++k) {
+            pipeline_t *f = expand_pipeline(a, &raw->fanout[k]);
+            if (!f) return NULL;
+            pl->fanout[k] = *f;
+        }
+    }
+    return pl;
+}
+
+/* break [N] / continue [N]: unwind N enclosing loops */
+static int loop_control(char **argv) {
+    int is_break = strcmp(argv[0], "break") == 0;
+    if (loop_depth == 0) {
+        fprintf(stderr, "%s: only meaningful in a loop\n", argv[0]);
+        return 1;
+    }
+    int n = argv[1] ? atoi(argv[1]) : 1;
+    if (n < 1) {
+        fprintf(stderr, "%s: %s: loop count out of range\n", argv[0], argv[1]);
+        return 1;
+    }
+    if (n > loop_depth) n = loop_depth;
+    if (is_break) break_levels = n;
+    else continue_levels = n;
+    return 0;
+}
+
+/* return [N]: leave the innermost function with status N (default $?) */
+static int func_return(char **argv) {
+    if (func_depth == 0) {
+        fprintf(stderr, "return: can only be used in a function\n");
+        return 1;
+    }
+    returning = 1;
+    return_status = argv[1] ? atoi(argv[1]) & 255 : last_status;
+    return return_status;
+}
+
+/* A lone function call with its redirections applied to the shell's own stdin/stdout */
+static int run_function(arena_t *a, const stage_t *st, char **argv) {
+    int in = -1, out = -1, saved_in = -1, saved_out = -1;
+    if (st->here) {
+        if ((in = here_fd(st->here)) < 0) return 1;
+    } else if (st->infile && (in = open(st->infile, O_RDONLY | O_CLOEXEC)) == -1) {
+        fprintf(stderr, "open infile: %s: %s\n", st->infile, strerror(errno));
+        return 1;
+    }
+    if (st->outfile && (out = open(st->outfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+        fprintf(stderr, "open outfile: %s: %s\n", st->outfile, strerror(errno));
+        if (in >= 0) close(in);
+        return 1;
+    }
+    if (in >= 0) {
+        saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+        dup2(in, STDIN_FILENO);
+        close(in);
+    }
+    if (out >= 0) {
+        fflush(stdout);
+        saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+        dup2(out, STDOUT_FILENO);
+        close(out);
+    }
+    int status = call_function(a, argv);
+    if (saved_out >= 0) {
+        fflush(stdout);
+        dup2(saved_out, STDOUT_FILENO);
+        close(saved_out);
+    }
+    if (saved_in >= 0) {
+        dup2(saved_in, STDIN_FILENO);
+        close(saved_in);
+    }
+    return status;
+}
+
+static int subst_status;         /* status of the last command substitution */
+
+/* Run one parsed pipeline (assignment, builtin or external); returns its status */
+static int run_pipeline(arena_t *a, const pipeline_t *raw) {
+    /* Assignment detection: every word is VARNAME=value */
+    if (raw->nstages == 1 && raw->stages[0].argc > 0 && !raw->background) {
+        const stage_t *st = &raw->stages[0];
+        int all = 1;
+        char *aname;
+        const char *aval;
+        for (int i = 0; i < st->argc && all; ++i) all = detect_assignment(a, st->argv[i], &aname, &aval);
+        if (all) {
+            time_mark_t tm;
+            if (raw->timed) time_mark(&tm);
+            subst_status = 0;   /* x=$(cmd) takes cmd's status */
+            for (int i = 0; i < st->argc; ++i) {
+                detect_assignment(a, st->argv[i], &aname, &aval);
+                char *value = expand_word(a, aval);
+                if (!value) {   /* x=$((1/0)) leaves x alone */
+                    subst_status = 1;
+                    break;
+                }
+                set_var(aname, value);
+            }
+            if (raw->timed) time_report(raw->text, &tm);
+            return subst_status;
+        }
+    }
+
+    /* Expand variables in argv arrays before execution */
+    uint64_t t0 = stats_now();
+    pipeline_t *pl = expand_pipeline(a, raw);
+    stats_record(STAT_EXPAND, t0);
+    if (!pl) return 1;
+    char **argv = pl->stages[0].argv;
+    if (pl->memo) return memo_run(pl);
+
+    /* A lone builtin runs in the shell itself unless it is in the background */
+    if (pl->nstages == 1 && !pl->nfanout && argv && argv[0]) {
+        if (strcmp(argv[0], "break") == 0 || strcmp(argv[0], "continue") == 0)
+            return loop_control(argv);
+        if (strcmp(argv[0], "return") == 0)
+            return func_return(argv);
+        if (!pl->background && is_builtin(argv[0]) && !stage_prefixed(argv)) {
+            const stage_t *st = &pl->stages[0];
+            spawn_req_t req = {
+                .argv = argv,
+                .infile = st->infile,
+                .outfile = st->outfile,
+                .in_fd = st->here ? here_fd(st->here) : -1,
+                .out_fd = -1,
+            };
+            if (st->here && req.in_fd < 0) return 1;
+            int status = run_builtin(&req, pl->timed);
+            if (req.in_fd >= 0) close(req.in_fd);
+            return status;
+        }
+        /* so does a function; timed, prefixed or in the background it gets a subshell */
+        if (!pl->background && !pl->timed && !stage_prefixed(argv) && is_function(argv[0]))
+            return run_function(a, &pl->stages[0], argv);
+    }
+
+    /* Pipelines, external commands and background builtins become a job */
+    return execute_pipeline(pl);
+}
+
+static int exec_node(arena_t *a, const node_t *n);
+
+/* Run a command list; stops early while a break/continue/return is unwinding */
+int exec_list(arena_t *a, const node_t *list) {
+    int status = 0;
+    for (const node_t *n = list; n; n = n->next) {
+        status = exec_node(a, n);
+        if (UNWINDING()) break;
+    }
+    return status;
+}
+
+/* After a loop body: consume this loop's share of a pending break/continue.
+   Returns 1 if the loop must stop. */
+static int loop_unwind(void) {
+    if (returning) return 1;
+    if (break_levels) {
+        break_levels--;
+        return 1;
+    }
+    if (continue_levels) {
+        continue_levels--;
+        return continue_levels > 0;   /* continue N > 1 leaves this loop too */
+    }
+    return 0;
+}
+
+static int exec_while(arena_t *a, const node_t *n) {
+    int status = 0;
+    loop_depth++;
+    while (1) {
+        int c = exec_list(a, n->cond);
+        if (UNWINDING()) {
+            if (loop_unwind()) break;
+            continue;
+        }
+        if ((c == 0) == n->until) break;
+        status = exec_list(a, n->body);
+        if (loop_unwind()) break;
+    }
+    loop_depth--;
+    return status;
+}
+
+static int exec_for(arena_t *a, const node_t *n) {
+    int status = 0;
+    arena_mark_t mark;
+    arena_mark(a, &mark);
+
+    /* the word list is expanded once, before the first iteration */
+    char *none[] = { NULL };
+    char **words = expand_argv(a, n->words ? n->words : none, NULL);
+    if (!words) {
+        arena_release(a, &mark);
+        return 1;
+    }
+
+    loop_depth++;
+    for (int i = 0; words[i]; ++i) {
+        set_var(n->var, words[i]);
+        status = exec_list(a, n->body);
+        if (loop_unwind()) break;
+    }
+    loop_depth--;
+    arena_release(a, &mark);
+    return status;
+}
+
+static int exec_node(arena_t *a, const node_t *n) {
+    int status = 0;
+    switch (n->type) {
+    case NODE_PIPELINE: {
+        if (jobs_count()) reap_background_jobs();   /* report completions between commands */
+        /* expansions for this run are dropped as soon as it finishes */
+        arena_mark_t mark;
+        arena_mark(a, &mark);
+        status = run_pipeline(a, n->pl);
+        arena_release(a, &mark);
+        break;
+    }
+    case NODE_IF:
+        status = exec_list(a, n->cond);
+        if (UNWINDING()) break;
+        if (status == 0) status = exec_list(a, n->body);
+        else status = n->els ? exec_list(a, n->els) : 0;
+        break;
+    case NODE_WHILE:
+        status = exec_while(a, n);
+        break;
+    case NODE_FOR:
+        status = exec_for(a, n);
+        break;
+    case NODE_FUNCDEF:
+        define_function(n->var, n->body);
+        break;
+    }
+    last_status = status;
+    return status;
+}
+
+/*
+ * Run a function body. Loops outside it are out of reach of its break and
+ * continue, and a `return` stops here, whatever loops it is nested in.
+ */
+int exec_function(arena_t *a, const node_t *body) {
+    int outer_loops = loop_depth;
+    loop_depth = 0;
+    func_depth++;
+    int status = exec_list(a, body);
+    if (returning) {
+        status = return_status;
+        returning = 0;
+    }
+    func_depth--;
+    loop_depth = outer_loops;
+    last_status = status;
+    return status;
+}
+
+/* Compile a line (reading continuation lines from `more` if needed) and run it */
+int run_line(arena_t *a, const char *line, input_t *more) {
+    int err = 0;
+    uint64_t t0 = stats_now();
+    node_t *list = parse_segments(a, line, more, &err);
+    stats_record(STAT_PARSE, t0);
+    if (err) {
+        last_status = 2;
+        return 2;
+    }
+    return exec_list(a, list);
+}
+
+/* Read all of a memfd into the arena and drop trailing newlines */
+static char *read_capture(arena_t *a, int fd, size_t *len) {
+    off_t size = lseek(fd, 0, SEEK_END);
+    char *buf = arena_alloc(a, size > 0 ? size + 1 : 1);
+    size_t got = 0;
+    while (size > 0 && got < (size_t)size) {
+        ssize_t n = pread(fd, buf + got, size - got, got);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += n;
+    }
+    while (got > 0 && buf[got - 1] == '\n') got--;
+    buf[got] = '\0';
+    *len = got;
+    return buf;
+}
+
+/*
+ * $(cmd): run cmd and return its output minus trailing newlines. A lone
+ * builtin that cannot change the shell's state runs right here and writes
+ * into a memory stream, so `$(echo $X)` costs no process at all. A single
+ * pipeline becomes a job whose stdout is a memfd; anything else runs in a
+ * forked copy of the shell writing to one. The memfd is then read back
+ * whole, since its size is known.
+ */
+char *command_subst(arena_t *a, const char *cmd, size_t *len) {
+    int err = 0, status = 0;
+    node_t *list = parse_segments(a, cmd, NULL, &err);
+    *len = 0;
+    if (err) { last_status = 2; return ""; }
+    if (!list) return "";
+
+    pipeline_t *pl = NULL;
+    if (list->type == NODE_PIPELINE && !list->next && !list->pl->background) {
+        pl = expand_pipeline(a, list->pl);
+        if (!pl) { last_status = subst_status = 1; return ""; }
+        const stage_t *st = &pl->stages[0];
+        char **argv = st->argv;
+        if (pl->nstages == 1 && !pl->nfanout && !st->infile && !st->outfile && !st->here &&
+            argv && argv[0] && is_builtin(argv[0]) && !builtin_needs_subshell(argv, 0)) {
+            char *buf = NULL;
+            size_t size = 0;
+            FILE *m = open_memstream(&buf, &size);
+            if (m) {
+                stats_count(CTR_BUILTINS);
+                handle_builtin(argv, &status, STDIN_FILENO, m);
+                fclose(m);
+                while (size > 0 && buf[size - 1] == '\n') size--;
+                char *out = arena_strndup(a, buf, size);
+                free(buf);
+                last_status = subst_status = status;
+                *len = size;
+                return out;
+            }
+        }
+    }
+
+    int fd = memfd_create("subst", MFD_CLOEXEC);
+    if (fd == -1) { perror("memfd_create"); return ""; }
+    if (pl) {
+        status = job_wait(launch_pipeline(pl, JOB_FOREGROUND, fd));
+    } else {
+        job_t *job = job_new(cmd, 1, JOB_FOREGROUND);
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            if (job_control_enabled()) setpgid(0, 0);
+            jobs_subshell();
+            dup2(fd, STDOUT_FILENO);
+            status = exec_list(a, list);
+            fflush(stdout);
+            _exit(status);
+        }
+        if (pid == -1) perror("fork");
+        job_add_pid(job, pid);
+        status = job_wait(job);
+    }
+    last_status = subst_status = status;
+    char *out = read_capture(a, fd, len);
+    close(fd);
+    return out;
+}
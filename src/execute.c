@@ -1,115 +1,267 @@
+#define _GNU_SOURCE     /* memfd_create */
 #include "shell.h"
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <limits.h>
 
-/* Helper: free argv array */
-static void free_argv(char **argv) {
-    if (!argv) return;
-    for (int i = 0; argv[i] != NULL; ++i) free(argv[i]);
-    free(argv);
+/*
+ * Builtins that change the shell's own state, which a pipeline stage must
+ * not. parallel and tee reading a pipe also get their own process: in the
+ * shell they would hold up the stages after them until their input ends.
+ */
+int builtin_needs_subshell(char **argv, int piped_in) {
+    static const char *const names[] = { "bg", "cd", "exit", "fg", "local", "wait", NULL };
+    for (int i = 0; names[i]; ++i) {
+        if (strcmp(argv[0], names[i]) == 0) return 1;
+    }
+    if (strcmp(argv[0], "parallel") == 0 || strcmp(argv[0], "tee") == 0) return piped_in;
+    return strcmp(argv[0], "set") == 0 && argv[1];
 }
 
-int execute_pipeline(char ***cmds_argv, char **infiles, char **outfiles, int ncmds, int background, const char *cmdline_for_job) {
-    if (ncmds <= 0) return -1;
-    if (ncmds == 1) {
-        char **argv = cmds_argv[0];
-        if (!argv || !argv[0]) return 0; /* nothing to run */
-
-        pid_t pid = fork();
-        if (pid == -1) { perror("fork"); return -1; }
-        if (pid == 0) {
-            /* child: handle redirection if any */
-            if (infiles && infiles[0]) {
-                int fd = open(infiles[0], O_RDONLY);
-                if (fd == -1) { perror("open infile"); exit(1); }
-                dup2(fd, STDIN_FILENO);
-                close(fd);
-            }
-            if (outfiles && outfiles[0]) {
-                int fd = open(outfiles[0], O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                if (fd == -1) { perror("open outfile"); exit(1); }
-                dup2(fd, STDOUT_FILENO);
-                close(fd);
-            }
-            execvp(argv[0], argv);
-            perror("execvp"); exit(1);
-        } else {
-            if (background) {
-                add_job(pid, cmdline_for_job ? cmdline_for_job : argv[0]);
-                return 0;
-            } else {
-                int status;
-                if (waitpid(pid, &status, 0) == -1) { perror("waitpid"); return -1; }
-                if (WIFEXITED(status)) return WEXITSTATUS(status);
-                return -1;
-            }
+/*
+ * Start one stage of a job. A builtin in a foreground job that cannot
+ * change the shell's state runs right here; with capture set its output
+ * goes to a memfd, which is returned rewound for the next stage to read
+ * (-1 otherwise). Anything else gets a process: a forked subshell for a
+ * builtin or a function, a spawned command for the rest.
+ */
+static int launch_stage(job_t *job, int mode, spawn_req_t *req, int piped_in, int capture) {
+    stage_ctl_t ctl;
+    if (stage_prefixed(req->argv)) {
+        int skip = stage_controls(req->argv, &ctl);
+        if (skip < 0) {
+            job_add_status(job, 2);
+            return -1;
+        }
+        req->argv += skip;
+        req->ctl = &ctl;
+    }
+    int is_bi = req->argv && is_builtin(req->argv[0]);
+    if (is_bi && !req->ctl && mode == JOB_FOREGROUND && !builtin_needs_subshell(req->argv, piped_in)) {
+        int mfd = capture ? memfd_create("builtin", MFD_CLOEXEC) : -1;
+        if (capture && mfd == -1) perror("memfd_create");   /* fall back to a subshell */
+        if (!capture || mfd >= 0) {
+            if (mfd >= 0) req->out_fd = mfd;
+            job_add_status(job, run_builtin(req, 0));
+            if (mfd >= 0) lseek(mfd, 0, SEEK_SET);
+            return mfd;
+        }
+    }
+    int in_shell = is_bi || (req->argv && is_function(req->argv[0]));
+    job_add_pid(job, in_shell ? spawn_builtin(req) : spawn_process(req));
+    if (req->ctl) job_set_ctl(job, ctl.desc);
+    return -1;
+}
+
+static int pipe_size = 0;       /* $PIPESIZE for the pipeline being launched; 0: default */
+
+/* $PIPESIZE: bytes, or with a K or M suffix */
+static int parse_pipe_size(void) {
+    const char *v = get_var("PIPESIZE");
+    if (!v || !*v) return 0;
+    char *end;
+    long n = strtol(v, &end, 10);
+    if (*end == 'k' || *end == 'K') { n *= 1024; end++; }
+    else if (*end == 'm' || *end == 'M') { n *= 1024 * 1024; end++; }
+    if (*end || n <= 0 || n > INT_MAX) {
+        fprintf(stderr, "PIPESIZE: %s: invalid size\n", v);
+        return 0;
+    }
+    return (int)n;
+}
+
+/* A close-on-exec pipe, resized to $PIPESIZE if that is set */
+static int make_pipe(int p[2]) {
+    if (pipe2(p, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    if (pipe_size && fcntl(p[1], F_SETPIPE_SZ, pipe_size) == -1) {
+        perror("PIPESIZE");     /* e.g. above /proc/sys/fs/pipe-max-size */
+        pipe_size = 0;          /* once per pipeline is enough */
+    }
+    return 0;
+}
+
+/* Here-documents and here-strings reach stdin through a memfd: no temp file, no writer process */
+int here_fd(const here_t *h) {
+    int fd = memfd_create("here", MFD_CLOEXEC);
+    if (fd == -1) {
+        perror("memfd_create");
+        return -1;
+    }
+    size_t len = strlen(h->text);
+    struct iovec iov[2] = { { h->text, len }, { "\n", 1 } };
+    int n = h->kind == HERE_STRING ? 2 : 1;     /* a here-string gets a newline */
+    size_t want = len + (n == 2);
+    ssize_t w = want ? writev(fd, iov, n) : 0;
+    if (w != (ssize_t)want) {
+        /* a short write to a memfd only happens when memory runs out */
+        perror("here-document");
+        close(fd);
+        return -1;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+static int count_stages(const pipeline_t *pl) {
+    int n = pl->nstages;
+    if (pl->nfanout) n++;       /* the tee stage */
+    for (int k = 0; k < pl->nfanout; ++k) n += count_stages(&pl->fanout[k]);
+    return n;
+}
+
+static void fail_stages(job_t *job, int n) {
+    while (n-- > 0) job_add_pid(job, -1);
+}
+
+static void launch_stages(job_t *job, int mode, const pipeline_t *pl, int in_fd, int out_fd);
+
+/*
+ * PIPELINE |> { A; B; ... }: feed is the producer's output (a pipe, or a
+ * memfd from an in-shell builtin). One tee stage copies it into a pipe per
+ * consumer with tee_fds(); the consumers share the job's stdout.
+ */
+static void launch_fanout(job_t *job, int mode, const pipeline_t *pl, int feed, int out_fd) {
+    int n = pl->nfanout;
+    int *rd = malloc(sizeof(int) * n), *wr = malloc(sizeof(int) * n);
+    for (int k = 0; k < n; ++k) {
+        int p[2];
+        if (make_pipe(p) == -1) {
+            for (int m = 0; m < k; ++m) { close(rd[m]); close(wr[m]); }
+            close(feed);
+            fail_stages(job, count_stages(pl) - pl->nstages);
+            free(rd);
+            free(wr);
+            return;
         }
+        rd[k] = p[0];
+        wr[k] = p[1];
     }
 
-    /* Multiple commands: set up (ncmds-1) pipes */
-    int pipes[ncmds-1][2];
-    for (int i = 0; i < ncmds-1; ++i) {
-        if (pipe(pipes[i]) == -1) { perror("pipe"); return -1; }
+    char *tee_argv[] = { "tee", NULL };
+    spawn_req_t req = {
+        .argv = tee_argv,
+        .in_fd = feed,
+        .out_fd = -1,
+        .close_fds = rd,        /* the tee stage must not hold a consumer's read end */
+        .nclose = n,
+        .setpgid = job_control_enabled() && mode != JOB_OWNED,
+        .pgid = job_spawn_pgid(job),
+    };
+    job_add_pid(job, spawn_tee(&req, wr, n));
+    close(feed);
+    for (int k = 0; k < n; ++k) close(wr[k]);
+
+    for (int k = 0; k < n; ++k) {
+        launch_stages(job, mode, &pl->fanout[k], rd[k], out_fd);
+        close(rd[k]);
     }
+    free(rd);
+    free(wr);
+}
 
-    pid_t last_child_pid = 0;
-    pid_t pids[ncmds];
+/* Start pl's stages into job: in_fd >= 0 feeds the first, out_fd >= 0 takes the last's output */
+static void launch_stages(job_t *job, int mode, const pipeline_t *pl, int in_fd, int out_fd) {
+    int ncmds = pl->nstages;
+    const stage_t *st = pl->stages;
+    int jc = job_control_enabled() && mode != JOB_OWNED;
 
+    /* with |> the last stage writes into the fan-out pipe */
+    int fan[2] = { -1, -1 }, last_out = out_fd;
+    if (pl->nfanout) {
+        if (make_pipe(fan) == -1) {
+            fail_stages(job, count_stages(pl));
+            return;
+        }
+        last_out = fan[1];
+    }
+
+    /*
+     * Each pipe is made just before the stage that writes to it and the
+     * parent drops its ends as soon as both stages are started, so it never
+     * holds more than one pipe. Every pipe is close-on-exec: a command keeps
+     * only the two ends dup'd onto its stdin and stdout.
+     */
+    int prev = in_fd;           /* what stage i reads: a pipe, a memfd or the caller's fd */
+    int prev_owned = 0;         /* prev is ours to close */
+    int piped = in_fd >= 0;     /* prev is a pipe another process writes to */
     for (int i = 0; i < ncmds; ++i) {
-        pid_t pid = fork();
-        if (pid == -1) { perror("fork"); return -1; }
-        if (pid == 0) {
-            /* child i */
-            if (i > 0) {
-                dup2(pipes[i-1][0], STDIN_FILENO);
-            } else if (infiles && infiles[i]) {
-                int fd = open(infiles[i], O_RDONLY);
-                if (fd == -1) { perror("open infile"); exit(1); }
-                dup2(fd, STDIN_FILENO); close(fd);
-            }
-
-            if (i < ncmds - 1) {
-                dup2(pipes[i][1], STDOUT_FILENO);
-            } else if (outfiles && outfiles[i]) {
-                int fd = open(outfiles[i], O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                if (fd == -1) { perror("open outfile"); exit(1); }
-                dup2(fd, STDOUT_FILENO); close(fd);
-            }
-
-            /* close all pipe fds in child */
-            for (int j = 0; j < ncmds-1; ++j) {
-                close(pipes[j][0]); close(pipes[j][1]);
-            }
-
-            char **argv = cmds_argv[i];
-            if (!argv || !argv[0]) exit(0);
-            execvp(argv[0], argv);
-            perror("execvp"); exit(1);
+        int last = i == ncmds - 1, p[2] = { -1, -1 };
+        if (!last && make_pipe(p) == -1) {
+            if (prev_owned) close(prev);
+            if (pl->nfanout) { close(fan[0]); close(fan[1]); }
+            fail_stages(job, count_stages(pl) - i);
+            return;
         }
-        /* parent */
-        pids[i] = pid;
-        last_child_pid = pid;
+
+        int next = -1, here = -1;
+        if (st[i].here && (here = here_fd(st[i].here)) == -1) {
+            job_add_status(job, 1);
+        } else if (!st[i].argv || !st[i].argv[0]) {
+            job_add_pid(job, -1);
+        } else {
+            spawn_req_t req = {
+                .argv = st[i].argv,
+                .infile = i == 0 ? st[i].infile : NULL,
+                .outfile = last ? st[i].outfile : NULL,
+                .in_fd = here >= 0 ? here : prev,
+                .out_fd = !last ? p[1] : st[i].outfile ? -1 : last_out,
+                .close_fds = &p[0],     /* a forked builtin never execs */
+                .nclose = !last,
+                .setpgid = jc,
+                .pgid = job_spawn_pgid(job),
+            };
+            next = launch_stage(job, mode, &req, piped && here < 0, !last || pl->nfanout > 0);
+        }
+        if (here >= 0) close(here);
+
+        if (prev_owned) close(prev);
+        if (!last) close(p[1]);
+        if (next >= 0 && !last) close(p[0]);    /* an in-shell builtin's output is in a memfd */
+        prev = next >= 0 ? next : p[0];
+        prev_owned = prev >= 0;
+        piped = next < 0;
+    }
+
+    if (pl->nfanout) {
+        close(fan[1]);
+        if (prev >= 0) close(fan[0]);   /* already captured in a memfd */
+        else prev = fan[0];
+        launch_fanout(job, mode, pl, prev, out_fd);
     }
+}
+
+/* Spawn every stage of a pipeline into a new job without waiting for it */
+job_t *launch_pipeline(const pipeline_t *pl, int mode, int out_fd) {
+    /* builtin output may still be buffered (stdout is fully buffered in scripts) */
+    fflush(stdout);
 
-    /* Parent: close all pipe fds */
-    for (int i = 0; i < ncmds-1; ++i) { close(pipes[i][0]); close(pipes[i][1]); }
+    job_t *job = job_new(pl->text ? pl->text : "(pipeline)", count_stages(pl), mode);
+    if (pl->timed) job_set_timed(job);
+    pipe_size = parse_pipe_size();
+    launch_stages(job, mode, pl, -1, out_fd);
+    return job;
+}
 
-    if (background) {
-        /* Add a single job record using first child's pid as job id (pids[0]) */
-        add_job(pids[0], cmdline_for_job ? cmdline_for_job : "(pipeline)");
+/* Launch a pipeline as one job; waits for it unless it runs in the background */
+int execute_pipeline(const pipeline_t *pl) {
+    if (!pl || pl->nstages <= 0) return -1;
+    if (pl->nstages == 1 && !pl->nfanout && (!pl->stages[0].argv || !pl->stages[0].argv[0]))
+        return 0; /* nothing to run */
+
+    stats_count(CTR_PIPELINES);
+    job_t *job = launch_pipeline(pl, pl->background ? JOB_BACKGROUND : JOB_FOREGROUND, -1);
+    if (pl->background) {
+        job_launched(job);
         return 0;
-    } else {
-        int status;
-        int last_status = -1;
-        /* wait for all children, capture status of last_child_pid */
-        for (int i = 0; i < ncmds; ++i) {
-            pid_t wpid = wait(&status);
-            if (wpid == -1) { perror("wait"); return -1; }
-            if (wpid == last_child_pid) {
-                if (WIFEXITED(status)) last_status = WEXITSTATUS(status);
-                else last_status = -1;
-            }
-        }
-        return last_status >= 0 ? last_status : -1;
     }
+    /* each stage is waited on by pid: other jobs' exits stay with the job table */
+    uint64_t t0 = stats_now();
+    int status = job_wait(job);
+    stats_record(STAT_WAIT, t0);
+    return status;
 }
@@ -0,0 +1,164 @@
+#include "shell.h"
+
+/*
+ * Shell functions: `name() { list; }`.
+ *
+ * A definition is parsed once, with the line that holds it, and its body
+ * is copied out of the line arena into an arena of its own, so a call runs
+ * the stored AST directly: no re-parse and no process. Calls get the
+ * arguments as $1..$n and a scope for `local`, both dropped on return.
+ *
+ * Redefining a function while it runs must not free the body under the
+ * running call, so every definition counts the calls executing it and is
+ * freed by the last one to return.
+ */
+
+#define FUNC_BUCKETS 64
+#define FUNC_MAX_DEPTH 1000     /* nested calls; deeper is almost surely runaway recursion */
+
+typedef struct {
+    arena_t arena;      /* owns body and everything below it */
+    node_t *body;
+    int running;        /* calls currently executing body */
+    int replaced;       /* no longer in the table: free once running drops to 0 */
+} func_def_t;
+
+typedef struct func_s {
+    char *name;
+    func_def_t *def;
+    struct func_s *chain;
+} func_t;
+
+static func_t *buckets[FUNC_BUCKETS];
+static int call_depth = 0;
+
+static unsigned long hash_name(const char *s) {
+    unsigned long h = 1469598103934665603UL;  /* FNV-1a */
+    for (; *s; ++s) { h ^= (unsigned char)*s; h *= 1099511628211UL; }
+    return h;
+}
+
+static func_t *find(const char *name) {
+    if (!name) return NULL;
+    for (func_t *f = buckets[hash_name(name) % FUNC_BUCKETS]; f; f = f->chain) {
+        if (strcmp(f->name, name) == 0) return f;
+    }
+    return NULL;
+}
+
+static char *copy_str(arena_t *a, const char *s) {
+    return s ? arena_strdup(a, s) : NULL;
+}
+
+static char **copy_words(arena_t *a, char **w) {
+    if (!w) return NULL;
+    int n = 0;
+    while (w[n]) n++;
+    char **c = arena_alloc(a, sizeof(char *) * (n + 1));
+    for (int i = 0; i < n; ++i) c[i] = arena_strdup(a, w[i]);
+    c[n] = NULL;
+    return c;
+}
+
+static void copy_pipeline(arena_t *a, pipeline_t *dst, const pipeline_t *src) {
+    *dst = *src;
+    dst->text = copy_str(a, src->text);
+    dst->stages = arena_alloc(a, sizeof(stage_t) * src->nstages);
+    for (int i = 0; i < src->nstages; ++i) {
+        const stage_t *s = &src->stages[i];
+        stage_t *d = &dst->stages[i];
+        *d = *s;
+        d->argv = copy_words(a, s->argv);
+        d->infile = copy_str(a, s->infile);
+        d->outfile = copy_str(a, s->outfile);
+        if (s->here) {
+            d->here = arena_alloc(a, sizeof(here_t));
+            d->here->kind = s->here->kind;
+            d->here->text = arena_strdup(a, s->here->text);
+        }
+    }
+    if (src->nfanout) {
+        dst->fanout = arena_alloc(a, sizeof(pipeline_t) * src->nfanout);
+        for (int i = 0; i < src->nfanout; ++i) copy_pipeline(a, &dst->fanout[i], &src->fanout[i]);
+    }
+}
+
+/* Deep copy of a command list into a */
+static node_t *copy_list(arena_t *a, const node_t *list) {
+    node_t *head = NULL, **tail = &head;
+    for (const node_t *n = list; n; n = n->next) {
+        node_t *c = arena_alloc(a, sizeof(node_t));
+        *c = *n;
+        c->next = NULL;
+        if (n->pl) {
+            c->pl = arena_alloc(a, sizeof(pipeline_t));
+            copy_pipeline(a, c->pl, n->pl);
+        }
+        c->cond = copy_list(a, n->cond);
+        c->body = copy_list(a, n->body);
+        c->els = copy_list(a, n->els);
+        c->var = copy_str(a, n->var);
+        c->words = copy_words(a, n->words);
+        *tail = c;
+        tail = &c->next;
+    }
+    return head;
+}
+
+static void def_release(func_def_t *d) {
+    if (d->running || !d->replaced) return;
+    arena_free(&d->arena);
+    free(d);
+}
+
+void define_function(const char *name, const node_t *body) {
+    func_def_t *d = calloc(1, sizeof(func_def_t));
+    arena_init(&d->arena);
+    d->body = copy_list(&d->arena, body);
+
+    func_t *f = find(name);
+    if (!f) {
+        unsigned long h = hash_name(name) % FUNC_BUCKETS;
+        f = calloc(1, sizeof(func_t));
+        f->name = strdup(name);
+        f->chain = buckets[h];
+        buckets[h] = f;
+    } else {
+        f->def->replaced = 1;
+        def_release(f->def);
+    }
+    f->def = d;
+}
+
+int is_function(const char *name) {
+    return find(name) != NULL;
+}
+
+int call_function(arena_t *a, char **argv) {
+    func_t *f = find(argv[0]);
+    if (!f) return 127;
+    if (call_depth == FUNC_MAX_DEPTH) {
+        fprintf(stderr, "%s: maximum function nesting level (%d) exceeded\n", argv[0], FUNC_MAX_DEPTH);
+        return 1;
+    }
+
+    /* $1.. are the arguments; $0 stays what it was */
+    int argc = 0;
+    while (argv[argc]) argc++;
+    char **params = arena_alloc(a, sizeof(char *) * (argc + 1));
+    memcpy(params, argv, sizeof(char *) * (argc + 1));
+    char **outer = set_params(params);
+    if (outer && outer[0]) params[0] = outer[0];
+
+    func_def_t *d = f->def;     /* f->def may be replaced while the body runs */
+    d->running++;
+    call_depth++;
+    push_locals();
+    int status = exec_function(a, d->body);
+    pop_locals();
+    call_depth--;
+    d->running--;
+    def_release(d);
+    set_params(outer);
+    return status;
+}
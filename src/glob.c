@@ -0,0 +1,356 @@
+#define _GNU_SOURCE     /* getdents64 */
+#include "shell.h"
+#include <dirent.h>
+#include <sys/stat.h>
+
+/*
+ * Pathname expansion for unquoted *, ? and [...].
+ *
+ * A pattern is matched one '/'-separated component at a time. Components
+ * without wildcards are taken as they are; the others are matched against
+ * the directory's listing. Listings are read with getdents64(2) in 256 KiB
+ * batches, sorted once, and kept in a small LRU cache keyed by path and
+ * checked against the directory's mtime on every use, so globbing the same
+ * 100k-entry directory again costs one stat(2). A literal prefix such as
+ * "log-2024*" is looked up by binary search in the sorted listing; only the
+ * names sharing it are matched.
+ *
+ * Matching is iterative: a '*' only remembers where to resume, so each name
+ * costs at most O(pattern * name) steps however many stars there are.
+ * Backslash quotes the next character; expand_argv() uses that for parts
+ * of a word that were quoted.
+ */
+
+#define GLOB_CACHE_DIRS 32
+#define GLOB_READ_BUF (256 * 1024)
+
+typedef struct {
+    char *path;             /* NULL = empty slot */
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    char *names;            /* entries as d_type byte, name, NUL */
+    uint32_t *off;          /* n offsets of the names, sorted by name */
+    int n;
+    unsigned long used;     /* LRU clock */
+} dir_listing_t;
+
+static dir_listing_t cache[GLOB_CACHE_DIRS];
+static unsigned long clock_tick;
+
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static void listing_free(dir_listing_t *d) {
+    free(d->path);
+    free(d->names);
+    free(d->off);
+    memset(d, 0, sizeof(*d));
+}
+
+static const char *sort_base;
+static int cmp_off(const void *a, const void *b) {
+    return strcmp(sort_base + *(const uint32_t *)a, sort_base + *(const uint32_t *)b);
+}
+
+/* Read every entry of dir except . and .. into d; 0 on success */
+static int listing_load(dir_listing_t *d, const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    char *buf = malloc(GLOB_READ_BUF);
+    size_t cap = 4096, len = 0;
+    int ncap = 256, n = 0;
+    char *names = malloc(cap);
+    uint32_t *off = malloc(sizeof(uint32_t) * ncap);
+
+    ssize_t got;
+    while ((got = getdents64(fd, buf, GLOB_READ_BUF)) > 0) {
+        for (ssize_t pos = 0; pos < got; ) {
+            struct linux_dirent64 *e = (struct linux_dirent64 *)(buf + pos);
+            pos += e->d_reclen;
+            const char *nm = e->d_name;
+            if (nm[0] == '.' && (nm[1] == '\0' || (nm[1] == '.' && nm[2] == '\0'))) continue;
+            size_t l = strlen(nm) + 1;
+            while (len + l + 1 > cap) names = realloc(names, cap *= 2);
+            if (n == ncap) off = realloc(off, sizeof(uint32_t) * (ncap *= 2));
+            names[len] = e->d_type;
+            memcpy(names + len + 1, nm, l);
+            off[n++] = len + 1;
+            len += l + 1;
+        }
+    }
+    close(fd);
+    free(buf);
+    if (got < 0) {
+        free(names);
+        free(off);
+        return -1;
+    }
+    sort_base = names;
+    qsort(off, n, sizeof(uint32_t), cmp_off);
+    d->names = names;
+    d->off = off;
+    d->n = n;
+    return 0;
+}
+
+/* The cached listing of dir, reloaded if the directory changed; NULL if unreadable */
+static dir_listing_t *listing(const char *dir) {
+    struct stat st;
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) return NULL;
+
+    dir_listing_t *d = NULL, *victim = &cache[0];
+    for (int i = 0; i < GLOB_CACHE_DIRS; ++i) {
+        if (cache[i].path && strcmp(cache[i].path, dir) == 0) { d = &cache[i]; break; }
+        if (!cache[i].path || (victim->path && cache[i].used < victim->used)) victim = &cache[i];
+    }
+    if (d && (d->dev != st.st_dev || d->ino != st.st_ino ||
+              d->mtime.tv_sec != st.st_mtim.tv_sec || d->mtime.tv_nsec != st.st_mtim.tv_nsec)) {
+        listing_free(d);
+        victim = d;
+        d = NULL;
+    }
+    if (!d) {
+        if (victim->path) listing_free(victim);
+        if (listing_load(victim, dir) != 0) return NULL;
+        d = victim;
+        d->path = strdup(dir);
+        d->dev = st.st_dev;
+        d->ino = st.st_ino;
+        d->mtime = st.st_mtim;
+    }
+    d->used = ++clock_tick;
+    return d;
+}
+
+/* [...] at *pp (just past '['): does c match? Advances *pp past ']'; -1 if unterminated */
+static int match_class(const char **pp, char c) {
+    const char *p = *pp;
+    int negate = 0, hit = 0;
+    if (*p == '!' || *p == '^') { negate = 1; p++; }
+    const char *first = p;
+    while (*p && (*p != ']' || p == first)) {
+        char lo = *p == '\\' && p[1] ? *++p : *p;
+        p++;
+        if (*p == '-' && p[1] && p[1] != ']') {
+            char hi = p[1] == '\\' && p[2] ? p[2] : p[1];
+            p += p[1] == '\\' && p[2] ? 3 : 2;
+            if ((unsigned char)lo <= (unsigned char)c && (unsigned char)c <= (unsigned char)hi) hit = 1;
+        } else if (lo == c) {
+            hit = 1;
+        }
+    }
+    if (*p != ']') return -1;
+    *pp = p + 1;
+    return hit != negate;
+}
+
+/* Does name match the single-component pattern pat? */
+static int match(const char *pat, const char *name) {
+    const char *star_p = NULL, *star_n = NULL;
+    if (name[0] == '.' && pat[0] != '.' && !(pat[0] == '\\' && pat[1] == '.'))
+        return 0;       /* dot files need an explicit dot */
+    while (*name) {
+        if (*pat == '*') {
+            while (*pat == '*') pat++;
+            if (!*pat) return 1;
+            star_p = pat;
+            star_n = name;
+            continue;
+        }
+        const char *p = pat;
+        int ok;
+        if (*p == '?') {
+            ok = 1;
+            p++;
+        } else if (*p == '[') {
+            p++;
+            ok = match_class(&p, *name);
+            if (ok < 0) { p = pat + 1; ok = *name == '['; }    /* no ']': a literal '[' */
+        } else {
+            if (*p == '\\' && p[1]) p++;
+            ok = *p && *p == *name;
+            if (*p) p++;
+        }
+        if (ok) {
+            pat = p;
+            name++;
+        } else if (star_p) {
+            /* let the last '*' absorb one more character and retry */
+            pat = star_p;
+            name = ++star_n;
+        } else {
+            return 0;
+        }
+    }
+    while (*pat == '*') pat++;
+    return *pat == '\0';
+}
+
+int glob_magic(const char *pat) {
+    for (const char *p = pat; *p; ++p) {
+        if (*p == '\\' && p[1]) p++;
+        else if (*p == '*' || *p == '?') return 1;
+        else if (*p == '[') {
+            /* only a closed class: `[ -f x ]` must not cost a directory read */
+            const char *q = p + 1;
+            if (match_class(&q, '\0') >= 0) return 1;
+        }
+    }
+    return 0;
+}
+
+/* pat[0..n) with backslash quoting removed */
+static char *unescape(arena_t *a, const char *pat, size_t n) {
+    char *out = arena_alloc(a, n + 1), *o = out;
+    for (size_t i = 0; i < n; ++i) {
+        if (pat[i] == '\\' && i + 1 < n) i++;
+        *o++ = pat[i];
+    }
+    *o = '\0';
+    return out;
+}
+
+typedef struct {
+    arena_t *a;
+    char **v;           /* matches so far */
+    int n, cap;
+    char *path;         /* the path being built; ends in '/' or is empty between components */
+    size_t path_cap;
+} glob_out_t;
+
+static void emit(glob_out_t *g, size_t len) {
+    if (g->n + 1 >= g->cap) {
+        int ncap = g->cap ? g->cap * 2 : 16;
+        char **nv = arena_alloc(g->a, sizeof(char *) * ncap);
+        if (g->n) memcpy(nv, g->v, sizeof(char *) * g->n);
+        g->v = nv;
+        g->cap = ncap;
+    }
+    g->v[g->n++] = arena_strndup(g->a, g->path, len);
+}
+
+/* Put s[0..n) at path[len] and NUL-terminate; returns the new length */
+static size_t path_put(glob_out_t *g, size_t len, const char *s, size_t n) {
+    if (len + n + 2 > g->path_cap) {
+        while (len + n + 2 > g->path_cap) g->path_cap *= 2;
+        g->path = realloc(g->path, g->path_cap);
+    }
+    memcpy(g->path + len, s, n);
+    g->path[len + n] = '\0';
+    return len + n;
+}
+
+/* Could entry i of d be a directory? path names it */
+static int entry_is_dir(const dir_listing_t *d, int i, const char *path) {
+    unsigned char type = d->names[d->off[i] - 1];
+    if (type == DT_DIR) return 1;
+    if (type != DT_LNK && type != DT_UNKNOWN) return 0;
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* First entry of d not sorting before prefix */
+static int lower_bound(const dir_listing_t *d, const char *prefix) {
+    int lo = 0, hi = d->n;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strcmp(d->names + d->off[mid], prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void walk(glob_out_t *g, size_t len, const char *pat);
+
+/* Continue after a component that ended at end ('/' or NUL); path[0..len) names it */
+static void next_component(glob_out_t *g, size_t len, const char *end) {
+    if (!*end) { emit(g, len); return; }
+    len = path_put(g, len, "/", 1);
+    while (*end == '/') end++;
+    walk(g, len, end);
+}
+
+/* Expand the rest of the pattern, pat, below path[0..len) */
+static void walk(glob_out_t *g, size_t len, const char *pat) {
+    if (!*pat) { emit(g, len); return; }    /* the pattern ended in '/' */
+    const char *end = strchr(pat, '/');
+    if (!end) end = pat + strlen(pat);
+    size_t clen = end - pat;
+    char *comp = arena_strndup(g->a, pat, clen);
+
+    if (!glob_magic(comp)) {
+        char *lit = unescape(g->a, comp, clen);
+        len = path_put(g, len, lit, strlen(lit));
+        struct stat st;
+        if (!*end && lstat(g->path, &st) != 0) return;
+        next_component(g, len, end);
+        return;
+    }
+
+    dir_listing_t *d = listing(len ? g->path : ".");
+    if (!d) return;
+    /* only names sharing the literal prefix can match */
+    size_t plen = 0;
+    while (plen < clen && !strchr("*?[", comp[plen])) plen += comp[plen] == '\\' && plen + 1 < clen ? 2 : 1;
+    char *prefix = unescape(g->a, comp, plen);
+    size_t prefix_len = strlen(prefix);
+
+    /* directories are collected first: deeper levels may evict d from the cache */
+    int nhit = 0;
+    char **hits = NULL;
+    int hcap = 0;
+    for (int i = lower_bound(d, prefix); i < d->n; ++i) {
+        const char *name = d->names + d->off[i];
+        if (strncmp(name, prefix, prefix_len) != 0) break;
+        if (!match(comp, name)) continue;
+        if (!*end) {
+            emit(g, path_put(g, len, name, strlen(name)));
+            continue;
+        }
+        path_put(g, len, name, strlen(name));
+        if (!entry_is_dir(d, i, g->path)) continue;
+        if (nhit == hcap) {
+            hcap = hcap ? hcap * 2 : 16;
+            char **nh = arena_alloc(g->a, sizeof(char *) * hcap);
+            if (nhit) memcpy(nh, hits, sizeof(char *) * nhit);
+            hits = nh;
+        }
+        hits[nhit++] = arena_strndup(g->a, name, strlen(name));
+    }
+    for (int k = 0; k < nhit; ++k) next_component(g, path_put(g, len, hits[k], strlen(hits[k])), end);
+}
+
+/*
+ * Paths matching pat, in sorted order (*n of them). When pat has no
+ * wildcards or matches nothing, the result is pat itself with its quoting
+ * removed, as the shell passes an unmatched pattern on unchanged.
+ */
+char **glob_expand(arena_t *a, const char *pat, int *n) {
+    glob_out_t g = { .a = a };
+    if (glob_magic(pat)) {
+        g.path_cap = 256;
+        g.path = malloc(g.path_cap);
+        g.path[0] = '\0';
+        const char *rest = pat;
+        size_t len = 0;
+        if (*rest == '/') {
+            len = path_put(&g, 0, "/", 1);
+            while (*rest == '/') rest++;
+        }
+        walk(&g, len, rest);
+        free(g.path);
+    }
+    if (!g.n) {
+        g.v = arena_alloc(a, sizeof(char *) * 2);
+        g.v[g.n++] = unescape(a, pat, strlen(pat));
+    }
+    g.v[g.n] = NULL;
+    *n = g.n;
+    return g.v;
+}
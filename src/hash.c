@@ -0,0 +1,261 @@
+#include "shell.h"
+#include <sys/stat.h>
+#include <time.h>
+
+/*
+ * Command hash: remembers where each command name was found on $PATH so a
+ * launch costs one posix_spawn instead of one failed execve per directory.
+ *
+ * Entries are dropped when $PATH changes, when the directory an entry came
+ * from (or any directory searched before it) changes mtime, and when the
+ * cached file turns out to be gone at spawn time.
+ */
+
+#define HASH_INIT_CAP 64
+#define HASH_RECHECK_NS 1000000000L   /* re-stat PATH directories at most once a second */
+
+typedef struct {
+    char *name;     /* NULL = empty slot */
+    char *path;
+    int dir;        /* index into path_dirs the command was found in */
+    unsigned long hits;
+} hash_entry_t;
+
+typedef struct {
+    char *dir;
+    struct timespec mtime;
+} path_dir_t;
+
+static hash_entry_t *table = NULL;
+static size_t table_cap = 0;
+static size_t table_used = 0;
+
+static char *path_snapshot = NULL;  /* $PATH the directory list was built from */
+static path_dir_t *path_dirs = NULL;
+static int path_ndirs = 0;
+static struct timespec last_recheck;
+
+static unsigned long hash_str(const char *s) {
+    unsigned long h = 1469598103934665603UL;  /* FNV-1a */
+    while (*s) { h ^= (unsigned char)*s++; h *= 1099511628211UL; }
+    return h;
+}
+
+static void dir_mtime(const char *dir, struct timespec *out) {
+    struct stat st;
+    if (stat(dir, &st) == 0) *out = st.st_mtim;
+    else out->tv_sec = out->tv_nsec = 0;
+}
+
+static void free_path_dirs(void) {
+    for (int i = 0; i < path_ndirs; ++i) free(path_dirs[i].dir);
+    free(path_dirs);
+    path_dirs = NULL;
+    path_ndirs = 0;
+    free(path_snapshot);
+    path_snapshot = NULL;
+}
+
+/* Split $PATH into path_dirs and record each directory's mtime */
+static void load_path_dirs(const char *path) {
+    free_path_dirs();
+    path_snapshot = strdup(path);
+    int cap = 8;
+    path_dirs = malloc(sizeof(path_dir_t) * cap);
+
+    const char *p = path;
+    while (1) {
+        const char *colon = strchr(p, ':');
+        size_t len = colon ? (size_t)(colon - p) : strlen(p);
+        if (path_ndirs >= cap) {
+            cap *= 2;
+            path_dirs = realloc(path_dirs, sizeof(path_dir_t) * cap);
+        }
+        /* an empty PATH element means the current directory */
+        path_dirs[path_ndirs].dir = len ? strndup(p, len) : strdup(".");
+        dir_mtime(path_dirs[path_ndirs].dir, &path_dirs[path_ndirs].mtime);
+        path_ndirs++;
+        if (!colon) break;
+        p = colon + 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &last_recheck);
+}
+
+static void entry_free(hash_entry_t *e) {
+    free(e->name);
+    free(e->path);
+    e->name = NULL;
+    e->path = NULL;
+}
+
+/* Remove slot i, shifting later entries of the probe run back (no tombstones) */
+static void table_delete_at(size_t i) {
+    entry_free(&table[i]);
+    table_used--;
+    size_t j = i;
+    while (1) {
+        j = (j + 1) & (table_cap - 1);
+        if (!table[j].name) break;
+        size_t home = hash_str(table[j].name) & (table_cap - 1);
+        /* move j into the hole if its home is not cyclically within (i, j] */
+        if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+            table[i] = table[j];
+            table[j].name = NULL;
+            table[j].path = NULL;
+            i = j;
+        }
+    }
+}
+
+static hash_entry_t *table_find(const char *name, size_t *slot) {
+    if (!table) return NULL;
+    size_t i = hash_str(name) & (table_cap - 1);
+    while (table[i].name) {
+        if (strcmp(table[i].name, name) == 0) {
+            if (slot) *slot = i;
+            return &table[i];
+        }
+        i = (i + 1) & (table_cap - 1);
+    }
+    return NULL;
+}
+
+static void table_insert(char *name, char *path, int dir) {
+    if (!table || (table_used + 1) * 10 > table_cap * 7) {
+        size_t old_cap = table_cap;
+        hash_entry_t *old = table;
+        table_cap = old_cap ? old_cap * 2 : HASH_INIT_CAP;
+        table = calloc(table_cap, sizeof(hash_entry_t));
+        table_used = 0;
+        for (size_t i = 0; i < old_cap; ++i) {
+            if (old[i].name) table_insert(old[i].name, old[i].path, old[i].dir);
+        }
+        free(old);
+    }
+    size_t i = hash_str(name) & (table_cap - 1);
+    while (table[i].name) i = (i + 1) & (table_cap - 1);
+    table[i].name = name;
+    table[i].path = path;
+    table[i].dir = dir;
+    table[i].hits = 0;
+    table_used++;
+}
+
+/* Drop every entry found in directory index >= first_dir */
+static void flush_from_dir(int first_dir) {
+    size_t i = 0;
+    while (i < table_cap) {
+        /* deletion may shift a later entry into slot i, so re-examine it */
+        if (table[i].name && table[i].dir >= first_dir) table_delete_at(i);
+        else i++;
+    }
+}
+
+/* Make sure the cache still matches $PATH and the directories on it */
+static void validate(void) {
+    const char *path = get_var("PATH");     /* a shell assignment wins over the environment */
+    if (!path) path = getenv("PATH");
+    if (!path) path = "/usr/local/bin:/usr/bin:/bin";
+
+    if (!path_snapshot || strcmp(path, path_snapshot) != 0) {
+        hash_clear();
+        load_path_dirs(path);
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    long elapsed = (now.tv_sec - last_recheck.tv_sec) * 1000000000L + (now.tv_nsec - last_recheck.tv_nsec);
+    if (elapsed < HASH_RECHECK_NS) return;
+    last_recheck = now;
+
+    /* a change in directory k can shadow or remove anything found in k or later */
+    for (int k = 0; k < path_ndirs; ++k) {
+        struct timespec m;
+        dir_mtime(path_dirs[k].dir, &m);
+        if (m.tv_sec != path_dirs[k].mtime.tv_sec || m.tv_nsec != path_dirs[k].mtime.tv_nsec) {
+            for (int j = k; j < path_ndirs; ++j) dir_mtime(path_dirs[j].dir, &path_dirs[j].mtime);
+            flush_from_dir(k);
+            return;
+        }
+    }
+}
+
+/* Walk PATH for cmd; returns malloc'd path and sets *dir_out, or NULL */
+static char *search_path(const char *cmd, int *dir_out) {
+    size_t clen = strlen(cmd);
+    for (int k = 0; k < path_ndirs; ++k) {
+        size_t dlen = strlen(path_dirs[k].dir);
+        char *full = malloc(dlen + clen + 2);
+        memcpy(full, path_dirs[k].dir, dlen);
+        full[dlen] = '/';
+        memcpy(full + dlen + 1, cmd, clen + 1);
+
+        struct stat st;
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0) {
+            *dir_out = k;
+            return full;
+        }
+        free(full);
+    }
+    return NULL;
+}
+
+const char *hash_lookup(const char *cmd) {
+    if (!cmd || !*cmd) return NULL;
+    validate();
+
+    hash_entry_t *e = table_find(cmd, NULL);
+    if (!e) {
+        int dir = -1;
+        char *full = search_path(cmd, &dir);
+        if (!full) return NULL;
+        table_insert(strdup(cmd), full, dir);
+        e = table_find(cmd, NULL);
+    }
+    e->hits++;
+    return e->path;
+}
+
+void hash_forget(const char *cmd) {
+    size_t slot;
+    if (cmd && table_find(cmd, &slot)) table_delete_at(slot);
+}
+
+void hash_clear(void) {
+    for (size_t i = 0; i < table_cap; ++i) {
+        if (table[i].name) entry_free(&table[i]);
+    }
+    table_used = 0;
+}
+
+void hash_print(FILE *out) {
+    if (table_used == 0) { fprintf(out, "hash: hash table empty\n"); return; }
+    fprintf(out, "hits\tcommand\n");
+    for (size_t i = 0; i < table_cap; ++i) {
+        if (table[i].name) fprintf(out, "%4lu\t%s\n", table[i].hits, table[i].path);
+    }
+}
+
+/* Builtin: hash [-r] [name ...] */
+int hash_builtin(char **argv, FILE *out) {
+    int i = 1;
+    if (argv[i] && strcmp(argv[i], "-r") == 0) { hash_clear(); i++; }
+    if (!argv[i]) {
+        if (i == 1) hash_print(out);
+        return 0;
+    }
+    int rc = 0;
+    for (; argv[i]; ++i) {
+        if (strchr(argv[i], '/')) continue;
+        hash_forget(argv[i]);
+        if (!hash_lookup(argv[i])) {
+            fprintf(stderr, "hash: %s: not found\n", argv[i]);
+            rc = 1;
+            continue;
+        }
+        /* `hash name` records the location without counting a use */
+        table_find(argv[i], NULL)->hits = 0;
+    }
+    return rc;
+}
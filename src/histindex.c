@@ -0,0 +1,195 @@
+#define _GNU_SOURCE     /* memmem */
+#include "shell.h"
+
+/*
+ * Trigram index over the history store.
+ *
+ * Every distinct 3-byte substring of an entry maps to an ascending posting
+ * list of entry numbers. A search for a pattern of 3+ bytes runs a
+ * leapfrog join over its trigrams' lists from the newest entry down,
+ * galloping each list's cursor, and confirms each number present in all of
+ * them with memmem(), so finding the newest match takes a handful of probes
+ * however long the history is. Patterns under 3 bytes fall back to
+ * a backward scan, which stops at the first (newest) hit.
+ *
+ * Every entry is indexed as it enters the history ring, by the startup
+ * scan of the file and then by add_history_cmd(), so no search ever pays
+ * for building the index. Entries that fall out of the ring are dropped
+ * from the lists in batches.
+ */
+
+#define TRI_INIT_SLOTS 4096
+#define TRI_MAX_QUERY 32        /* trigrams of a pattern used for filtering */
+#define PRUNE_BATCH 65536       /* evicted entries tolerated before pruning */
+
+typedef struct {
+    uint32_t key;               /* packed trigram + 1; 0 marks an empty slot */
+    uint32_t len, cap;
+    uint32_t *post;             /* entry numbers, ascending */
+} tri_list_t;
+
+static tri_list_t *slots = NULL;
+static size_t nslots = 0, nused = 0;
+static long pruned_below = 0;   /* numbers below this are gone from every list; 0 if empty */
+
+static uint32_t tri_key(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+    return ((uint32_t)u[0] | (uint32_t)u[1] << 8 | (uint32_t)u[2] << 16) + 1;
+}
+
+static size_t slot_of(uint32_t key, size_t cap) {
+    return (key * 2654435761u) & (cap - 1);
+}
+
+static void grow_slots(void) {
+    size_t ncap = nslots ? nslots * 2 : TRI_INIT_SLOTS;
+    tri_list_t *n = calloc(ncap, sizeof(tri_list_t));
+    for (size_t i = 0; i < nslots; ++i) {
+        if (!slots[i].key) continue;
+        size_t j = slot_of(slots[i].key, ncap);
+        while (n[j].key) j = (j + 1) & (ncap - 1);
+        n[j] = slots[i];
+    }
+    free(slots);
+    slots = n;
+    nslots = ncap;
+}
+
+static tri_list_t *tri_find(uint32_t key, int create) {
+    if (create && (nused + 1) * 10 > nslots * 7) grow_slots();
+    if (!nslots) return NULL;
+    size_t i = slot_of(key, nslots);
+    while (slots[i].key) {
+        if (slots[i].key == key) return &slots[i];
+        i = (i + 1) & (nslots - 1);
+    }
+    if (!create) return NULL;
+    slots[i].key = key;
+    nused++;
+    return &slots[i];
+}
+
+static void post_add(tri_list_t *l, uint32_t n) {
+    if (l->len && l->post[l->len - 1] == n) return;     /* trigram repeats in this entry */
+    if (l->len == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 4;
+        l->post = realloc(l->post, sizeof(uint32_t) * l->cap);
+    }
+    l->post[l->len++] = n;
+}
+
+void hindex_add(long n, const char *s, size_t len) {
+    if (!pruned_below) pruned_below = n;
+    for (size_t i = 0; i + 3 <= len; ++i) post_add(tri_find(tri_key(s + i), 1), (uint32_t)n);
+}
+
+void hindex_clear(void) {
+    for (size_t i = 0; i < nslots; ++i) free(slots[i].post);
+    free(slots);
+    slots = NULL;
+    nslots = nused = 0;
+    pruned_below = 0;
+}
+
+/* index of the first element >= n */
+static size_t lower_bound(const tri_list_t *l, uint32_t n) {
+    size_t lo = 0, hi = l->len;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (l->post[mid] < n) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+/* Drop numbers that have left the history ring */
+static void prune(long first) {
+    for (size_t i = 0; i < nslots; ++i) {
+        tri_list_t *l = &slots[i];
+        if (!l->key) continue;
+        size_t k = lower_bound(l, (uint32_t)first);
+        if (k == 0) continue;
+        memmove(l->post, l->post + k, sizeof(uint32_t) * (l->len - k));
+        l->len -= k;
+    }
+    pruned_below = first;
+}
+
+/*
+ * Largest element <= n, searching only below *hi and moving *hi down to it.
+ * Queries only ever move downwards, so galloping back from the previous
+ * position costs a few probes instead of a full binary search.
+ */
+static long last_at_most(const tri_list_t *l, size_t *hi, uint32_t n) {
+    size_t top = *hi, step = 1, lo;
+    if (top == 0) return -1;
+    if (l->post[top - 1] <= n) { *hi = top; return l->post[top - 1]; }
+    /* gallop: find lo with post[lo] <= n < post[top - 1] */
+    while (step < top && l->post[top - 1 - step] > n) step *= 2;
+    lo = step < top ? top - 1 - step : 0;
+    size_t end = top - 1 - step / 2;    /* post[end] > n */
+    if (l->post[lo] > n) { *hi = 0; return -1; }
+    while (lo + 1 < end) {
+        size_t mid = (lo + end) / 2;
+        if (l->post[mid] <= n) lo = mid; else end = mid;
+    }
+    *hi = lo + 1;
+    return l->post[lo];
+}
+
+static int contains(const char *s, size_t len, const char *pat, size_t plen) {
+    return memmem(s, len, pat, plen) != NULL;
+}
+
+static long scan(const char *pat, size_t plen, long before) {
+    for (long n = before - 1; n >= history_first(); --n) {
+        size_t len;
+        const char *s = history_at(n, &len);
+        if (s && contains(s, len, pat, plen)) return n;
+    }
+    return 0;
+}
+
+static int by_len(const void *a, const void *b) {
+    const tri_list_t *x = *(tri_list_t *const *)a, *y = *(tri_list_t *const *)b;
+    return (x->len > y->len) - (x->len < y->len);
+}
+
+long history_find(const char *pat, long before) {
+    size_t plen = strlen(pat);
+    long first = history_first();
+    if (before > history_last() + 1) before = history_last() + 1;
+    if (before <= first) return 0;
+    if (plen < 3) return scan(pat, plen, before);
+
+    if (first - pruned_below >= PRUNE_BATCH) prune(first);
+
+    tri_list_t *lists[TRI_MAX_QUERY];
+    int nl = 0;
+    for (size_t i = 0; i + 3 <= plen && nl < TRI_MAX_QUERY; ++i) {
+        tri_list_t *l = tri_find(tri_key(pat + i), 0);
+        if (!l || l->len == 0) return 0;    /* a trigram no entry has */
+        int dup = 0;
+        for (int k = 0; k < nl && !dup; ++k) dup = lists[k] == l;
+        if (!dup) lists[nl++] = l;
+    }
+    qsort(lists, nl, sizeof(lists[0]), by_len);
+
+    /* leapfrog join from the newest allowed number downwards */
+    size_t hi[TRI_MAX_QUERY];
+    for (int k = 0; k < nl; ++k) hi[k] = lists[k]->len;
+    long target = before - 1;
+    while (target >= first) {
+        int k;
+        for (k = 0; k < nl; ++k) {
+            long v = last_at_most(lists[k], &hi[k], (uint32_t)target);
+            if (v < 0) return 0;
+            if (v < target) { target = v; break; }     /* skip ahead; start over */
+        }
+        if (k < nl) continue;
+        size_t len;
+        const char *s = history_at(target, &len);
+        if (s && contains(s, len, pat, plen)) return target;
+        target--;
+    }
+    return 0;
+}
@@ -1,52 +1,300 @@
 #include "shell.h"
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/uio.h>
 
-/* Circular buffer for history */
-static char *history_buf[HISTORY_SIZE];
-static int history_count = 0;   // how many commands currently stored (<= HISTORY_SIZE)
-static int history_next = 0;    // index where next command will be written
+/*
+ * Persistent command history.
+ *
+ * Entries live in $HISTFILE (default ~/.myshell_history), one command per
+ * line, appended with O_APPEND under flock() so any number of shells can
+ * share the file. At startup the file is read into one buffer and scanned
+ * once with memchr(); the last $HISTSIZE entries are indexed in a ring that
+ * points straight into that buffer, so loading 100k entries costs no
+ * per-entry allocation. The buffer is private: another shell truncating
+ * or rewriting the file cannot pull entries out from under the ring.
+ *
+ * History numbers are file line numbers and therefore the same in every
+ * shell and every session. Before appending, a shell picks up whatever
+ * other shells appended since it last looked, so its numbering never
+ * diverges from the file. When the file grows past twice $HISTSIZE it is
+ * rewritten with only the newest entries and a "#base N" first line that
+ * keeps the numbering where it was. Every entry that enters the ring is
+ * added to the trigram index in histindex.c, which searches go through.
+ */
+
+typedef struct {
+    const char *s;      /* not NUL-terminated: into file_buf or an owned copy */
+    size_t len;
+    int owned;
+} hist_entry_t;
+
+static hist_entry_t *ring = NULL;
+static long ring_cap = 0;
+static long hist_count = 0;     /* entries in the ring (<= ring_cap) */
+static long hist_last = 0;      /* number of the newest entry; 0 if none */
+
+static char *hist_path = NULL;
+static int hist_fd = -1;
+static ino_t hist_ino = 0;
+static off_t file_end = 0;      /* bytes of the file already indexed */
+static char *file_buf = NULL;  /* the file as loaded; ring entries point into it */
+
+static void ring_push(const char *s, size_t len, int owned) {
+    hist_entry_t *e = &ring[hist_last % ring_cap];
+    if (hist_count == ring_cap && e->owned) free((char *)e->s);
+    e->s = s;
+    e->len = len;
+    e->owned = owned;
+    hist_last++;
+    if (hist_count < ring_cap) hist_count++;
+    hindex_add(hist_last, s, len);
+}
+
+static hist_entry_t *entry(long n) {
+    if (n <= hist_last - hist_count || n > hist_last) return NULL;
+    return &ring[(n - 1) % ring_cap];
+}
+
+/* Non-empty lines in buf[0..len) */
+static long count_lines(const char *buf, size_t len) {
+    long n = 0;
+    for (const char *p = buf, *end = buf + len; p < end; ) {
+        const char *nl = memchr(p, '\n', end - p);
+        if (!nl) nl = end;
+        n += nl > p;
+        p = nl + 1;
+    }
+    return n;
+}
+
+/* Number the first n non-empty lines of buf without indexing them; bytes skipped */
+static size_t skip_lines(const char *buf, size_t len, long n) {
+    const char *p = buf, *end = buf + len;
+    while (p < end && n > 0) {
+        const char *nl = memchr(p, '\n', end - p);
+        if (!nl) nl = end;
+        if (nl > p) { hist_last++; n--; }
+        p = nl + 1;
+    }
+    return p < end ? (size_t)(p - buf) : len;
+}
+
+/* Index every line of buf; owned: copy them (buf is temporary) */
+static void index_lines(const char *buf, size_t len, int owned) {
+    const char *p = buf, *end = buf + len;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        size_t n = (nl ? nl : end) - p;
+        if (n) ring_push(owned ? strndup(p, n) : p, n, owned);
+        p += n + 1;
+    }
+}
+
+static void clear_ring(void) {
+    for (long i = 0; i < ring_cap; ++i) {
+        if (ring[i].owned) free((char *)ring[i].s);
+        ring[i].s = NULL;
+        ring[i].owned = 0;
+    }
+    hist_count = 0;
+    hist_last = 0;
+    hindex_clear();
+}
+
+static long env_long(const char *name, long def) {
+    const char *v = get_var(name);
+    if (!v) v = getenv(name);
+    long n = v ? atol(v) : 0;
+    return n > 0 ? n : def;
+}
+
+/* Rewrite the file with only what the ring holds, keeping the numbering */
+static void trim_file(void) {
+    size_t plen = strlen(hist_path);
+    char *tmp = malloc(plen + 32);
+    snprintf(tmp, plen + 32, "%s.%d.tmp", hist_path, (int)getpid());
+    FILE *f = fopen(tmp, "w");
+    if (!f) { free(tmp); return; }
+    fprintf(f, "#base %ld\n", hist_last - hist_count + 1);
+    for (long n = hist_last - hist_count + 1; n <= hist_last; ++n) {
+        hist_entry_t *e = entry(n);
+        fwrite(e->s, 1, e->len, f);
+        fputc('\n', f);
+    }
+    if (fclose(f) == 0 && rename(tmp, hist_path) == 0) {
+        struct stat st;
+        int fd = open(hist_path, O_RDWR | O_APPEND | O_CLOEXEC);
+        if (fd >= 0 && fstat(fd, &st) == 0) {
+            close(hist_fd);
+            hist_fd = fd;
+            hist_ino = st.st_ino;
+            file_end = st.st_size;
+        } else if (fd >= 0) {
+            close(fd);
+        }
+    } else {
+        unlink(tmp);
+    }
+    free(tmp);
+}
+
+static void sync_file(void);
+
+/* (Re)load the history file into the ring */
+static void load_file(void) {
+    struct stat st;
+    clear_ring();
+    free(file_buf);
+    file_buf = NULL;
+    if (hist_fd >= 0) close(hist_fd);
+
+    hist_fd = open(hist_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (hist_fd < 0) return;    /* no file: history stays in memory only */
+    size_t len = 0;
+    flock(hist_fd, LOCK_SH);
+    if (fstat(hist_fd, &st) == 0) {
+        hist_ino = st.st_ino;
+        if (st.st_size > 0 && (file_buf = malloc(st.st_size))) {
+            while (len < (size_t)st.st_size) {
+                ssize_t got = pread(hist_fd, file_buf + len, st.st_size - len, len);
+                if (got < 0 && errno == EINTR) continue;
+                if (got <= 0) break;
+                len += got;
+            }
+        }
+        file_end = len;
+    }
+    flock(hist_fd, LOCK_UN);
+    if (!len) return;
+
+    const char *p = file_buf;
+    if (len > 6 && memcmp(p, "#base ", 6) == 0) {
+        const char *nl = memchr(p, '\n', len);
+        hist_last = atol(p + 6) - 1;
+        if (hist_last < 0) hist_last = 0;
+        size_t skip = nl ? (size_t)(nl - p) + 1 : len;
+        p += skip;
+        len -= skip;
+    }
+    long base = hist_last;
+    /* lines the ring would evict anyway are only counted, not indexed */
+    long lines = count_lines(p, len);
+    if (lines > ring_cap) {
+        size_t skip = skip_lines(p, len, lines - ring_cap);
+        p += skip;
+        len -= skip;
+    }
+    index_lines(p, len, 0);
+    if (hist_last - base > 2 * ring_cap) {
+        flock(hist_fd, LOCK_EX);
+        sync_file();    /* lines appended since the scan must survive the rewrite */
+        if (hist_fd >= 0) trim_file();
+        if (hist_fd >= 0) flock(hist_fd, LOCK_UN);
+    }
+}
 
 void init_history(void) {
-    for (int i = 0; i < HISTORY_SIZE; i++) history_buf[i] = NULL;
+    ring_cap = env_long("HISTSIZE", HISTORY_DEFAULT_SIZE);
+    ring = calloc(ring_cap, sizeof(hist_entry_t));
+    hist_count = hist_last = 0;
+
+    const char *file = get_var("HISTFILE");
+    if (!file) file = getenv("HISTFILE");
+    if (file) {
+        if (!*file) return;     /* HISTFILE= : keep history in memory only */
+        hist_path = strdup(file);
+    } else {
+        const char *home = getenv("HOME");
+        if (!home) return;
+        size_t n = strlen(home) + sizeof("/.myshell_history");
+        hist_path = malloc(n);
+        snprintf(hist_path, n, "%s/.myshell_history", home);
+    }
+    load_file();
 }
 
 void free_history(void) {
-    for (int i = 0; i < HISTORY_SIZE; i++) {
-        free(history_buf[i]);
-        history_buf[i] = NULL;
+    if (ring) clear_ring();
+    free(ring);
+    ring = NULL;
+    ring_cap = 0;
+    free(file_buf);
+    file_buf = NULL;
+    if (hist_fd >= 0) close(hist_fd);
+    hist_fd = -1;
+    free(hist_path);
+    hist_path = NULL;
+}
+
+/* Pick up lines other shells appended since we last looked (file is locked) */
+static void sync_file(void) {
+    struct stat st, cur;
+    if (fstat(hist_fd, &st) != 0) return;
+    if ((stat(hist_path, &cur) == 0 && cur.st_ino != hist_ino) || st.st_size < file_end) {
+        load_file();    /* trimmed, replaced or truncated by another shell */
+        if (hist_fd >= 0) flock(hist_fd, LOCK_EX);
+        return;
     }
-    history_count = 0;
-    history_next = 0;
+    if (st.st_size == file_end) return;
+    size_t n = st.st_size - file_end;
+    char *buf = malloc(n);
+    ssize_t got = pread(hist_fd, buf, n, file_end);
+    if (got > 0) {
+        index_lines(buf, got, 1);
+        file_end += got;
+    }
+    free(buf);
 }
 
 void add_history_cmd(const char *cmd) {
-    if (cmd == NULL || *cmd == '\0') return;
-
-    // If overwriting existing entry, free it
-    free(history_buf[history_next]);
-    history_buf[history_next] = strdup(cmd);
+    if (cmd == NULL || *cmd == '\0' || !ring) return;
+    size_t len = strlen(cmd);
+    if (memchr(cmd, '\n', len)) return;     /* one line per entry */
 
-    history_next = (history_next + 1) % HISTORY_SIZE;
-    if (history_count < HISTORY_SIZE) history_count++;
+    if (hist_fd >= 0) {
+        flock(hist_fd, LOCK_EX);
+        sync_file();
+        /* one write of "cmd\n": O_APPEND keeps concurrent shells' lines whole */
+        struct iovec iov[2] = { { (void *)cmd, len }, { "\n", 1 } };
+        if (hist_fd >= 0 && writev(hist_fd, iov, 2) == (ssize_t)len + 1) file_end += len + 1;
+        if (hist_fd >= 0) flock(hist_fd, LOCK_UN);
+    }
+    ring_push(strndup(cmd, len), len, 1);
 }
 
-/* Print history numbered 1..history_count, oldest -> newest */
-void print_history(void) {
-    if (history_count == 0) {
-        printf("No history.\n");
+/* history [N]: the last N entries (all by default) with their numbers */
+void print_history(FILE *out, long last_n) {
+    if (hist_count == 0) {
+        fprintf(out, "No history.\n");
         return;
     }
-    int start = (history_next - history_count + HISTORY_SIZE) % HISTORY_SIZE;
-    for (int i = 0; i < history_count; i++) {
-        int idx = (start + i) % HISTORY_SIZE;
-        printf("%d\t%s\n", i + 1, history_buf[idx]);
+    long first = hist_last - hist_count + 1;
+    if (last_n > 0 && last_n < hist_count) first = hist_last - last_n + 1;
+    for (long n = first; n <= hist_last; ++n) {
+        hist_entry_t *e = entry(n);
+        fprintf(out, "%5ld\t%.*s\n", n, (int)e->len, e->s);
     }
 }
 
-/* Return strdup'd command for number n (1-based), or NULL if out of bounds */
-char *get_history_cmd_by_number(int n) {
-    if (n <= 0 || n > history_count) return NULL;
-    int start = (history_next - history_count + HISTORY_SIZE) % HISTORY_SIZE;
-    int idx = (start + (n - 1)) % HISTORY_SIZE;
-    if (history_buf[idx] == NULL) return NULL;
-    return strdup(history_buf[idx]);
+long history_first(void) {
+    return hist_last - hist_count + 1;
+}
+
+long history_last(void) {
+    return hist_last;
+}
+
+/* Entry n (not NUL-terminated), or NULL if it is not held in memory */
+const char *history_at(long n, size_t *len) {
+    hist_entry_t *e = entry(n);
+    if (!e) return NULL;
+    *len = e->len;
+    return e->s;
+}
+
+/* Return strdup'd command for number n, or NULL if out of bounds */
+char *get_history_cmd_by_number(long n) {
+    hist_entry_t *e = entry(n);
+    return e ? strndup(e->s, e->len) : NULL;
 }
@@ -0,0 +1,192 @@
+#include "shell.h"
+#include <readline/readline.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Line sources for the shell: the interactive terminal (readline, driven
+ * from a poll() loop that also watches for finished jobs), script
+ * files (mmap'd whole), -c strings, and non-terminal stdin (mmap'd when it
+ * is a regular file, otherwise read in large blocks). Lines have no length
+ * limit and are returned borrowed: valid until the next read_cmd() call.
+ */
+
+#define INPUT_BLOCK 65536
+
+struct input_s {
+    int fd;             /* descriptor being read in blocks, -1 otherwise */
+    int interactive;    /* terminal: readline with prompts */
+    int sync_offset;    /* keep fd's offset just past the consumed lines */
+    char *data;         /* mapped file, -c string, or block buffer */
+    size_t len;
+    size_t pos;         /* start of the next unread line */
+    size_t cap;         /* block buffer capacity (0 when not reading blocks) */
+    int mapped;
+    char *line;         /* NUL-terminated copy of the current line */
+    size_t line_cap;
+    char *rl_line;      /* last readline() result, freed on the next read */
+};
+
+static input_t *input_new(void) {
+    input_t *in = calloc(1, sizeof(input_t));
+    in->fd = -1;
+    return in;
+}
+
+input_t *input_open_tty(void) {
+    input_t *in = input_new();
+    in->interactive = 1;
+    return in;
+}
+
+input_t *input_open_string(const char *s) {
+    input_t *in = input_new();
+    in->data = strdup(s);
+    in->len = strlen(s);
+    return in;
+}
+
+/* Map a regular file whole; returns 0 if fd is not a mappable file */
+static int map_fd(input_t *in, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return 0;
+    if (st.st_size == 0) return 1;
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) return 0;
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    in->data = p;
+    in->len = st.st_size;
+    in->mapped = 1;
+    return 1;
+}
+
+input_t *input_open_file(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+    input_t *in = input_new();
+    if (!map_fd(in, fd)) {
+        in->fd = fd;    /* a FIFO or device: fall back to block reads */
+        return in;
+    }
+    close(fd);
+    return in;
+}
+
+input_t *input_open_fd(int fd) {
+    input_t *in = input_new();
+    off_t off = lseek(fd, 0, SEEK_CUR);
+    if (off >= 0 && map_fd(in, fd)) {
+        /* commands run from the script share this fd: keep its offset in step */
+        in->pos = (size_t)off <= in->len ? (size_t)off : in->len;
+        in->fd = fd;
+        in->sync_offset = 1;
+        return in;
+    }
+    in->fd = fd;
+    return in;
+}
+
+int input_interactive(const input_t *in) {
+    return in && in->interactive;
+}
+
+void input_close(input_t *in) {
+    if (!in) return;
+    if (in->mapped) munmap(in->data, in->len);
+    else free(in->data);
+    if (in->fd > STDERR_FILENO) close(in->fd);
+    free(in->line);
+    free(in->rl_line);
+    free(in);
+}
+
+/* Pull another block from in->fd; returns bytes read (0 at EOF) */
+static ssize_t fill(input_t *in) {
+    /* drop consumed bytes, then make room for a full block */
+    if (in->pos > 0) {
+        memmove(in->data, in->data + in->pos, in->len - in->pos);
+        in->len -= in->pos;
+        in->pos = 0;
+    }
+    if (in->cap - in->len < INPUT_BLOCK) {
+        in->cap = in->cap ? in->cap * 2 : INPUT_BLOCK * 2;
+        in->data = realloc(in->data, in->cap);
+    }
+    ssize_t n;
+    do {
+        n = read(in->fd, in->data + in->len, in->cap - in->len);
+    } while (n == -1 && errno == EINTR);
+    if (n <= 0) return 0;
+    in->len += n;
+    return n;
+}
+
+/* readline callback state for the interactive event loop */
+static char *cb_line;
+static int cb_done;
+
+static void on_line(char *line) {
+    cb_line = line;
+    cb_done = 1;
+    rl_callback_handler_remove();
+}
+
+/* Event loop: feed terminal input to readline while reporting finished
+   background jobs the moment SIGCHLD arrives, without waiting for Enter */
+static char *read_interactive(const char *prompt) {
+    cb_line = NULL;
+    cb_done = 0;
+    rl_callback_handler_install(prompt, on_line);
+
+    while (!cb_done) {
+        struct pollfd fds[2] = {
+            { .fd = STDIN_FILENO, .events = POLLIN },
+            { .fd = jobs_event_fd(), .events = POLLIN },
+        };
+        int nfds = fds[1].fd >= 0 ? 2 : 1;
+        if (poll(fds, nfds, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            rl_callback_handler_remove();
+            return NULL;
+        }
+        if (nfds == 2 && (fds[1].revents & POLLIN)) {
+            /* print notifications above the prompt, then redraw the line being edited */
+            rl_clear_visible_line();
+            reap_background_jobs();
+            rl_forced_update_display();
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) rl_callback_read_char();
+    }
+    return cb_line;
+}
+
+char *read_cmd(input_t *in, const char *prompt) {
+    if (in->interactive) {
+        free(in->rl_line);
+        in->rl_line = read_interactive(prompt);
+        return in->rl_line; /* NULL on Ctrl-D */
+    }
+
+    int blocks = in->fd >= 0 && !in->mapped;
+    const char *nl;
+    while (1) {
+        nl = in->pos < in->len ? memchr(in->data + in->pos, '\n', in->len - in->pos) : NULL;
+        if (nl || !blocks || fill(in) == 0) break;
+    }
+    if (in->pos >= in->len) return NULL;
+
+    size_t end = nl ? (size_t)(nl - in->data) : in->len;
+    size_t n = end - in->pos;
+    if (n + 1 > in->line_cap) {
+        in->line_cap = n + 1 > 256 ? n + 1 : 256;
+        in->line = realloc(in->line, in->line_cap);
+    }
+    memcpy(in->line, in->data + in->pos, n);
+    in->line[n] = '\0';
+    in->pos = nl ? end + 1 : end;
+
+    if (in->sync_offset) lseek(in->fd, in->pos, SEEK_SET);
+    return in->line;
+}
@@ -1,70 +1,690 @@
 #include "shell.h"
 #include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
-#define MAX_JOBS 128
+/*
+ * Job table.
+ *
+ * Every pipeline the shell launches is one job: a process group (when job
+ * control is on) plus the pid and status of each stage. Jobs are kept in a
+ * list in start order (for `jobs`) and every process is indexed by pid in a
+ * chained hash table that grows with the number of processes, so there is
+ * no fixed limit and lookups stay O(1) with thousands of workers.
+ *
+ * Foreground jobs are waited on pid by pid, so waiting never consumes
+ * another job's exit status. SIGCHLD is blocked and delivered through a
+ * signalfd; the interactive event loop in read_cmd() polls that fd and
+ * reaps background jobs the moment they exit, scripts drain it between
+ * commands.
+ */
 
-typedef struct {
-    pid_t pid;
+#define JOBS_INIT_BUCKETS 64
+
+enum { PROC_RUNNING, PROC_STOPPED, PROC_DONE };
+
+typedef struct proc_s {
+    pid_t pid;              /* 0 if the stage failed to launch */
+    int state;
+    int status;             /* exit status, or 128+signal */
+    struct timespec end;    /* when it was reaped */
+    struct rusage ru;       /* from wait4() */
+    char *ctl;              /* stage controls (pin=0-3 ...), NULL if none */
+    struct job_s *job;
+    struct proc_s *hnext;   /* pid hash chain */
+} proc_t;
+
+struct job_s {
+    int id;                 /* %n */
+    pid_t pgid;             /* 0 without job control */
+    proc_t *procs;
+    int nprocs;             /* launched so far */
+    int cap;
+    int mode;               /* JOB_FOREGROUND, JOB_BACKGROUND or JOB_OWNED */
     char *cmd;
-} job_t;
+    int timed;              /* `time` prefix: report resource usage when it finishes */
+    struct timespec start;
+    struct job_s *prev, *next;  /* start order */
+};
+
+static job_t *jobs_head = NULL, *jobs_tail = NULL;
+static proc_t **buckets = NULL;
+static size_t nbuckets = 0;
+static size_t nprocs_total = 0;
+static int njobs = 0;
+
+static int sigchld_fd = -1;
+static int sigchld_seen = 0;    /* signalfd drained by a wait loop since the last report */
+static int job_control = 0;     /* interactive: process groups + terminal handoff */
+static pid_t shell_pgid = 0;
+static int pipefail = 0;
+static int unreported = 0;      /* children reaped since background jobs were last reported */
+
+static size_t bucket_of(pid_t pid) {
+    return ((size_t)pid * 2654435761u) & (nbuckets - 1);
+}
+
+static void hash_insert(proc_t *p) {
+    size_t b = bucket_of(p->pid);
+    p->hnext = buckets[b];
+    buckets[b] = p;
+}
+
+static void rehash(size_t n) {
+    proc_t **ob = buckets;
+    size_t old = nbuckets;
+    buckets = calloc(n, sizeof(proc_t *));
+    nbuckets = n;
+    for (size_t i = 0; i < old; ++i) {
+        proc_t *p = ob[i];
+        while (p) {
+            proc_t *next = p->hnext;
+            hash_insert(p);
+            p = next;
+        }
+    }
+    free(ob);
+}
 
-static job_t jobs[MAX_JOBS];
+static proc_t *find_proc(pid_t pid) {
+    if (!buckets || pid <= 0) return NULL;
+    for (proc_t *p = buckets[bucket_of(pid)]; p; p = p->hnext) {
+        if (p->pid == pid) return p;
+    }
+    return NULL;
+}
+
+static void hash_remove(proc_t *p) {
+    proc_t **pp = &buckets[bucket_of(p->pid)];
+    while (*pp && *pp != p) pp = &(*pp)->hnext;
+    if (*pp) *pp = p->hnext;
+}
 
 void init_jobs_table(void) {
-    for (int i = 0; i < MAX_JOBS; ++i) { jobs[i].pid = 0; jobs[i].cmd = NULL; }
+    rehash(JOBS_INIT_BUCKETS);
+
+    /* route SIGCHLD through a signalfd; spawned children get the mask cleared */
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &set, NULL) == -1) { perror("sigprocmask"); return; }
+    sigchld_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sigchld_fd == -1) perror("signalfd");
+}
+
+/* Interactive shells put each job in its own process group and hand it the terminal */
+void init_job_control(int interactive) {
+    if (!interactive || !isatty(STDIN_FILENO)) return;
+    /* wait until we are in the foreground before taking over */
+    while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp())) kill(-shell_pgid, SIGTTIN);
+
+    signal(SIGTTOU, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+
+    shell_pgid = getpid();
+    if (getpgrp() != shell_pgid && setpgid(0, shell_pgid) == -1) { perror("setpgid"); return; }
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    job_control = 1;
+}
+
+void jobs_subshell(void) {
+    job_control = 0;
+}
+
+int job_control_enabled(void) {
+    return job_control;
+}
+
+void set_pipefail(int on) {
+    pipefail = on;
+}
+
+int get_pipefail(void) {
+    return pipefail;
+}
+
+int jobs_event_fd(void) {
+    return sigchld_fd;
+}
+
+int jobs_count(void) {
+    return njobs;
+}
+
+static int job_done(const job_t *j);
+
+static double elapsed(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static double tv_secs(const struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* A maxrss below 0 prints as "-": the shell's own peak says nothing about one command */
+static void print_time_row(const char *label, pid_t pid, double real, const struct rusage *ru) {
+    char pidbuf[16] = "-", rss[24] = "-";
+    if (pid > 0) snprintf(pidbuf, sizeof(pidbuf), "%d", (int)pid);
+    if (ru->ru_maxrss >= 0) snprintf(rss, sizeof(rss), "%ldk", ru->ru_maxrss);
+    fprintf(stderr, "%-6s %7s %9.3fs %9.3fs %9.3fs %9s %6ld %6ld\n", label, pidbuf, real,
+            tv_secs(&ru->ru_utime), tv_secs(&ru->ru_stime), rss, ru->ru_nvcsw, ru->ru_nivcsw);
+}
+
+static void print_time_header(const char *cmd) {
+    fprintf(stderr, "time: %s\n%-6s %7s %10s %10s %10s %9s %6s %6s\n", cmd,
+            "stage", "pid", "real", "user", "sys", "maxrss", "vcsw", "ivcsw");
+}
+
+/* `time` report: one row per stage, then the whole pipeline */
+static void print_times(const job_t *j) {
+    struct rusage total;
+    struct timespec last = j->start;
+    memset(&total, 0, sizeof(total));
+    print_time_header(j->cmd);
+    for (int i = 0; i < j->nprocs; ++i) {
+        const proc_t *p = &j->procs[i];
+        char label[16];
+        snprintf(label, sizeof(label), "%d", i + 1);
+        print_time_row(label, p->pid, elapsed(&j->start, &p->end), &p->ru);
+        timeradd(&total.ru_utime, &p->ru.ru_utime, &total.ru_utime);
+        timeradd(&total.ru_stime, &p->ru.ru_stime, &total.ru_stime);
+        if (p->ru.ru_maxrss > total.ru_maxrss) total.ru_maxrss = p->ru.ru_maxrss;
+        total.ru_nvcsw += p->ru.ru_nvcsw;
+        total.ru_nivcsw += p->ru.ru_nivcsw;
+        if (elapsed(&last, &p->end) > 0) last = p->end;
+    }
+    print_time_row("total", j->pgid, elapsed(&j->start, &last), &total);
+}
+
+void time_mark(time_mark_t *m) {
+    clock_gettime(CLOCK_MONOTONIC, &m->start);
+    getrusage(RUSAGE_SELF, &m->ru);
+    getrusage(RUSAGE_CHILDREN, &m->children);
+}
+
+/*
+ * `time` on work done inside the shell (a builtin, an assignment, a memo
+ * hit): the shell's usage since the mark plus that of the children reaped
+ * meanwhile, such as a $(...) in an assignment. Only the times and switch
+ * counts can be taken as differences; maxrss is a lifetime peak, so it is
+ * left out.
+ */
+void time_report(const char *cmd, const time_mark_t *m) {
+    struct timespec now;
+    struct rusage ru, ch;
+    getrusage(RUSAGE_SELF, &ru);
+    getrusage(RUSAGE_CHILDREN, &ch);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    timersub(&ru.ru_utime, &m->ru.ru_utime, &ru.ru_utime);
+    timersub(&ru.ru_stime, &m->ru.ru_stime, &ru.ru_stime);
+    timersub(&ch.ru_utime, &m->children.ru_utime, &ch.ru_utime);
+    timersub(&ch.ru_stime, &m->children.ru_stime, &ch.ru_stime);
+    timeradd(&ru.ru_utime, &ch.ru_utime, &ru.ru_utime);
+    timeradd(&ru.ru_stime, &ch.ru_stime, &ru.ru_stime);
+    ru.ru_nvcsw += ch.ru_nvcsw - m->ru.ru_nvcsw - m->children.ru_nvcsw;
+    ru.ru_nivcsw += ch.ru_nivcsw - m->ru.ru_nivcsw - m->children.ru_nivcsw;
+    ru.ru_maxrss = -1;
+    print_time_header(cmd);
+    print_time_row("total", getpid(), elapsed(&m->start, &now), &ru);
+}
+
+/* `time` on a builtin: it runs in the shell, so the shell's own usage is what is measured */
+int timed_builtin(char **argv, int *status, int in_fd, FILE *out) {
+    time_mark_t m;
+    time_mark(&m);
+    int handled = handle_builtin(argv, status, in_fd, out);
+    if (!handled) return 0;
+    fflush(out);
+    time_report(argv[0], &m);
+    return 1;
+}
+
+static void unlink_job(job_t *j) {
+    if (j->timed && job_done(j)) print_times(j);
+    if (j->prev) j->prev->next = j->next; else jobs_head = j->next;
+    if (j->next) j->next->prev = j->prev; else jobs_tail = j->prev;
+    for (int i = 0; i < j->nprocs; ++i) {
+        if (j->procs[i].pid > 0) { hash_remove(&j->procs[i]); nprocs_total--; }
+        free(j->procs[i].ctl);
+    }
+    free(j->procs);
+    free(j->cmd);
+    free(j);
+    njobs--;
+}
+
+job_t *job_new(const char *cmdline, int nstages, int mode) {
+    job_t *j = calloc(1, sizeof(job_t));
+    /* numbers restart from 1 whenever the table empties, like other shells */
+    j->id = jobs_tail ? jobs_tail->id + 1 : 1;
+    j->cap = nstages > 0 ? nstages : 1;
+    /* procs never move once allocated: the hash points into this array */
+    j->procs = calloc(j->cap, sizeof(proc_t));
+    j->mode = mode;
+    j->cmd = strdup(cmdline ? cmdline : "");
+    clock_gettime(CLOCK_MONOTONIC, &j->start);
+    j->prev = jobs_tail;
+    if (jobs_tail) jobs_tail->next = j; else jobs_head = j;
+    jobs_tail = j;
+    njobs++;
+    return j;
+}
+
+pid_t job_spawn_pgid(const job_t *j) {
+    return j->pgid;
+}
+
+void job_set_ctl(job_t *j, const char *desc) {
+    if (j->nprocs > 0 && desc && *desc) j->procs[j->nprocs - 1].ctl = strdup(desc);
+}
+
+/* Record a launched stage (pid <= 0: the stage failed to start, counted as status 127) */
+void job_add_status(job_t *j, int status) {
+    if (j->nprocs >= j->cap) return;
+    proc_t *p = &j->procs[j->nprocs++];
+    p->job = j;
+    p->pid = 0;
+    p->state = PROC_DONE;
+    p->status = status;
+    clock_gettime(CLOCK_MONOTONIC, &p->end);
+}
+
+void job_add_pid(job_t *j, pid_t pid) {
+    if (pid <= 0) { job_add_status(j, 127); return; }
+    if (j->nprocs >= j->cap) return;
+    proc_t *p = &j->procs[j->nprocs++];
+    p->job = j;
+    p->pid = pid;
+    p->state = PROC_RUNNING;
+    if (job_control && j->mode != JOB_OWNED) {
+        if (!j->pgid) j->pgid = pid;
+        setpgid(pid, j->pgid);      /* also done in the child; whichever runs first wins */
+        if (j->mode == JOB_FOREGROUND) tcsetpgrp(STDIN_FILENO, j->pgid);
+    }
+    if (nprocs_total + 1 > nbuckets) rehash(nbuckets * 2);
+    hash_insert(p);
+    nprocs_total++;
+}
+
+static int decode_status(int st) {
+    if (WIFEXITED(st)) return WEXITSTATUS(st);
+    if (WIFSIGNALED(st)) return 128 + WTERMSIG(st);
+    return 0;
+}
+
+static void record(proc_t *p, int st, const struct rusage *ru) {
+    if (WIFSTOPPED(st)) { p->state = PROC_STOPPED; p->status = 128 + WSTOPSIG(st); }
+    else if (WIFCONTINUED(st)) p->state = PROC_RUNNING;
+    else {
+        p->state = PROC_DONE;
+        p->status = decode_status(st);
+        p->ru = *ru;
+        clock_gettime(CLOCK_MONOTONIC, &p->end);
+    }
 }
 
-void add_job(pid_t pid, const char *cmdline) {
-    if (pid <= 0) return;
-    for (int i = 0; i < MAX_JOBS; ++i) {
-        if (jobs[i].pid == 0) {
-            jobs[i].pid = pid;
-            jobs[i].cmd = strdup(cmdline ? cmdline : "");
-            printf("[+] Background job started: PID %d\n", pid);
-            return;
+void job_set_timed(job_t *j) {
+    j->timed = 1;
+}
+
+static int job_done(const job_t *j) {
+    for (int i = 0; i < j->nprocs; ++i) {
+        if (j->procs[i].state != PROC_DONE) return 0;
+    }
+    return 1;
+}
+
+static int job_stopped(const job_t *j) {
+    int stopped = 0;
+    for (int i = 0; i < j->nprocs; ++i) {
+        if (j->procs[i].state == PROC_RUNNING) return 0;
+        if (j->procs[i].state == PROC_STOPPED) stopped = 1;
+    }
+    return stopped;
+}
+
+/* Exit status of a finished job: last stage, or with pipefail the last failing one */
+static int job_status(const job_t *j) {
+    if (j->nprocs == 0) return 0;
+    if (pipefail) {
+        for (int i = j->nprocs - 1; i >= 0; --i) {
+            if (j->procs[i].status != 0) return j->procs[i].status;
+        }
+        return 0;
+    }
+    return j->procs[j->nprocs - 1].status;
+}
+
+/* PIPESTATUS holds every stage's status of the last foreground pipeline */
+static void set_pipestatus(const job_t *j) {
+    char buf[512];
+    size_t n = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < j->nprocs && n < sizeof(buf) - 16; ++i)
+        n += snprintf(buf + n, sizeof(buf) - n, i ? " %d" : "%d", j->procs[i].status);
+    set_var("PIPESTATUS", buf);
+}
+
+static const char *job_state_name(const job_t *j) {
+    if (job_done(j)) return "Done";
+    if (job_stopped(j)) return "Stopped";
+    return "Running";
+}
+
+void job_launched(job_t *j) {
+    pid_t pid = j->pgid ? j->pgid : (j->nprocs ? j->procs[0].pid : 0);
+    printf("[+] Background job [%d] started: PID %d\n", j->id, pid);
+}
+
+/* wait4() one stage by pid; returns 1 if its state changed */
+static int wait_proc(proc_t *p, int flags) {
+    int st;
+    struct rusage ru;
+    pid_t r;
+    while ((r = wait4(p->pid, &st, flags | WUNTRACED, &ru)) == -1 && errno == EINTR) ;
+    if (r == 0) return 0;
+    if (r == -1) {
+        /* reaped elsewhere (reap_children() would have marked it done): status lost, never a success */
+        memset(&ru, 0, sizeof(ru));
+        record(p, W_EXITCODE(127, 0), &ru);
+        return 1;
+    }
+    record(p, st, &ru);
+    return 1;
+}
+
+/*
+ * Wait for every stage of j, each by its own pid; returns the stop signal if
+ * the job was stopped, else 0. While several stages run, the loop sleeps on
+ * the SIGCHLD event and polls only this job's pids, so each stage's exit is
+ * timestamped when it happens rather than when its turn comes.
+ */
+static int wait_job(job_t *j) {
+    while (1) {
+        int running = 0;
+        proc_t *last = NULL;
+        for (int i = 0; i < j->nprocs; ++i) {
+            proc_t *p = &j->procs[i];
+            if (p->state == PROC_RUNNING) wait_proc(p, WNOHANG);
+            if (p->state == PROC_STOPPED) return p->status - 128;
+            if (p->state == PROC_RUNNING) { running++; last = p; }
         }
+        if (!running) return 0;
+        if (running == 1) wait_proc(last, 0);
+        else jobs_wait_event();
     }
-    fprintf(stderr, "jobs: job table full, cannot add PID %d\n", pid);
 }
 
-void remove_job(pid_t pid) {
-    for (int i = 0; i < MAX_JOBS; ++i) {
-        if (jobs[i].pid == pid) {
-            free(jobs[i].cmd);
-            jobs[i].cmd = NULL;
-            jobs[i].pid = 0;
-            return;
+/* Take the terminal back after a foreground job */
+static void reclaim_terminal(void) {
+    if (job_control) tcsetpgrp(STDIN_FILENO, shell_pgid);
+}
+
+int job_wait(job_t *j) {
+    int stopsig = wait_job(j);
+    reclaim_terminal();
+    if (stopsig) {
+        j->mode = JOB_BACKGROUND;
+        printf("\n[%d]+ Stopped\t%s\n", j->id, j->cmd);
+        return 128 + stopsig;
+    }
+    int status = job_status(j);
+    if (j->mode == JOB_FOREGROUND) set_pipestatus(j);
+    unlink_job(j);
+    return status;
+}
+
+/* Job spec: %n, %% / %+ (most recent) or a pid belonging to a job */
+static job_t *parse_job_spec(const char *spec) {
+    if (!spec || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0 || strcmp(spec, "%") == 0)
+        return jobs_tail;
+    if (spec[0] == '%') {
+        int id = atoi(spec + 1);
+        for (job_t *j = jobs_head; j; j = j->next) {
+            if (j->id == id) return j;
         }
+        return NULL;
     }
+    proc_t *p = find_proc(atoi(spec));
+    return p ? p->job : NULL;
 }
 
-void print_jobs(void) {
-    int found = 0;
-    for (int i = 0; i < MAX_JOBS; ++i) {
-        if (jobs[i].pid != 0) {
-            printf("%d\t%s\n", jobs[i].pid, jobs[i].cmd ? jobs[i].cmd : "");
-            found = 1;
+static void print_job(FILE *out, const job_t *j, int with_pids) {
+    fprintf(out, "[%d]%c %-8s ", j->id, j == jobs_tail ? '+' : ' ', job_state_name(j));
+    if (with_pids) {
+        for (int i = 0; i < j->nprocs; ++i) {
+            const proc_t *p = &j->procs[i];
+            if (p->pid > 0 && p->ctl) fprintf(out, "%d[%s] ", p->pid, p->ctl);
+            else if (p->pid > 0) fprintf(out, "%d ", p->pid);
         }
     }
-    if (!found) printf("No background jobs.\n");
+    fprintf(out, "%s%s\n", j->cmd, j->mode == JOB_BACKGROUND && !job_stopped(j) ? " &" : "");
+}
+
+void print_jobs(FILE *out, int with_pids) {
+    int any = 0;
+    for (job_t *j = jobs_head; j; j = j->next) {
+        if (j->mode != JOB_BACKGROUND) continue;   /* running in the foreground or owned by a builtin */
+        print_job(out, j, with_pids);
+        any = 1;
+    }
+    if (!any) fprintf(out, "No background jobs.\n");
 }
 
-void reap_background_jobs(void) {
-    int status;
+/* Collect every exited/stopped child into the table (no output) */
+static int reap_children(void) {
+    int status, reaped = 0;
     pid_t pid;
-    /* Non-blocking loop to reap all finished children */
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        /* Print notification */
-        if (WIFEXITED(status)) {
-            int code = WEXITSTATUS(status);
-            printf("[+] Job %d finished (exit %d)\n", pid, code);
-        } else if (WIFSIGNALED(status)) {
-            int sig = WTERMSIG(status);
-            printf("[+] Job %d terminated by signal %d\n", pid, sig);
-        } else {
-            printf("[+] Job %d ended\n", pid);
+    struct rusage ru;
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru)) > 0) {
+        proc_t *p = find_proc(pid);
+        reaped++;
+        if (p) record(p, status, &ru);
+    }
+    unreported += reaped;
+    return reaped;
+}
+
+/* Print and drop finished background jobs */
+static void report_done_jobs(void) {
+    job_t *j = jobs_head;
+    while (j) {
+        job_t *next = j->next;
+        if (j->mode == JOB_BACKGROUND && job_done(j)) {
+            int st = job_status(j);
+            if (st > 128 && j->procs[j->nprocs - 1].status == st)
+                printf("[+] Job [%d] %d terminated by signal %d\n", j->id, j->pgid ? j->pgid : j->procs[0].pid, st - 128);
+            else
+                printf("[+] Job [%d] %d finished (exit %d)\n", j->id, j->pgid ? j->pgid : j->procs[0].pid, st);
+            unlink_job(j);
+        }
+        j = next;
+    }
+}
+
+/* Reap every finished child and report the background ones; returns how many were reaped */
+int reap_background_jobs(void) {
+    /* drain the signalfd: one read may stand for several exits, so waitpid decides */
+    struct signalfd_siginfo si;
+    if (sigchld_fd >= 0) {
+        int pending = sigchld_seen;
+        while (read(sigchld_fd, &si, sizeof(si)) == sizeof(si)) pending = 1;
+        sigchld_seen = 0;
+        /* nothing new, and nothing collected elsewhere (wait -n, parallel) left to report */
+        if (!pending && !unreported) return 0;
+    }
+    int reaped = reap_children();
+    report_done_jobs();
+    unreported = 0;
+    fflush(stdout);
+    return reaped;
+}
+
+/* Collect exited children into the table without reporting anything */
+int jobs_reap(void) {
+    return reap_children();
+}
+
+/* Check an owned job: 1 and its status once every stage has exited (the job is freed) */
+int job_collect(job_t *j, int *status) {
+    if (!job_done(j)) return 0;
+    *status = job_status(j);
+    unlink_job(j);
+    return 1;
+}
+
+/* Block until SIGCHLD arrives (or a short timeout as a safety net) */
+void jobs_wait_event(void) {
+    struct pollfd pfd = { .fd = sigchld_fd, .events = POLLIN };
+    if (sigchld_fd < 0) { usleep(10000); return; }
+    poll(&pfd, 1, 1000);
+    struct signalfd_siginfo si;
+    /* remembered for reap_background_jobs(): the exit may belong to a background job */
+    while (read(sigchld_fd, &si, sizeof(si)) == sizeof(si)) sigchld_seen = 1;
+}
+
+static void continue_job(job_t *j) {
+    for (int i = 0; i < j->nprocs; ++i) {
+        if (j->procs[i].state == PROC_STOPPED) j->procs[i].state = PROC_RUNNING;
+    }
+    if (j->pgid) kill(-j->pgid, SIGCONT);
+    else {
+        for (int i = 0; i < j->nprocs; ++i) {
+            if (j->procs[i].state != PROC_DONE) kill(j->procs[i].pid, SIGCONT);
+        }
+    }
+}
+
+/* fg [job] */
+static int builtin_fg(char **argv, FILE *out) {
+    job_t *j = parse_job_spec(argv[1]);
+    if (!j) { fprintf(stderr, "fg: %s: no such job\n", argv[1] ? argv[1] : "current"); return 1; }
+    fprintf(out, "%s\n", j->cmd);
+    fflush(out);
+    j->mode = JOB_FOREGROUND;
+    if (job_control && j->pgid) tcsetpgrp(STDIN_FILENO, j->pgid);
+    continue_job(j);
+    return job_wait(j);
+}
+
+/* bg [job] */
+static int builtin_bg(char **argv, FILE *out) {
+    job_t *j = parse_job_spec(argv[1]);
+    if (!j) { fprintf(stderr, "bg: %s: no such job\n", argv[1] ? argv[1] : "current"); return 1; }
+    j->mode = JOB_BACKGROUND;
+    continue_job(j);
+    fprintf(out, "[%d]+ %s &\n", j->id, j->cmd);
+    return 0;
+}
+
+/* wait [-n] [job|pid ...] */
+static int builtin_wait(char **argv) {
+    int i = 1, any = 0, status = 0;
+    if (argv[i] && strcmp(argv[i], "-n") == 0) { any = 1; i++; }
+
+    if (any) {
+        /* first background job to finish, event driven */
+        if (!jobs_head) return 127;
+        while (1) {
+            reap_children();
+            for (job_t *j = jobs_head; j; j = j->next) {
+                if (j->mode == JOB_BACKGROUND && job_done(j)) {
+                    status = job_status(j);
+                    unlink_job(j);
+                    return status;
+                }
+            }
+            int have = 0;
+            for (job_t *j = jobs_head; j; j = j->next) have |= j->mode == JOB_BACKGROUND && !job_stopped(j);
+            if (!have) return 127;
+            jobs_wait_event();
+        }
+    }
+
+    if (!argv[i]) {
+        /* every background job, each waited on by pid */
+        job_t *j = jobs_head;
+        while (j) {
+            job_t *next = j->next;
+            if (j->mode == JOB_BACKGROUND && !job_stopped(j)) { wait_job(j); status = job_status(j); unlink_job(j); }
+            j = next;
+        }
+        return status;
+    }
+    for (; argv[i]; ++i) {
+        job_t *j = parse_job_spec(argv[i]);
+        if (!j) { fprintf(stderr, "wait: %s: no such job\n", argv[i]); status = 127; continue; }
+        wait_job(j);
+        status = job_done(j) ? job_status(j) : 128 + SIGTSTP;
+        if (job_done(j)) unlink_job(j);
+    }
+    return status;
+}
+
+static const struct { const char *name; int sig; } signames[] = {
+    { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "KILL", SIGKILL },
+    { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "PIPE", SIGPIPE }, { "ALRM", SIGALRM },
+    { "TERM", SIGTERM }, { "CONT", SIGCONT }, { "STOP", SIGSTOP }, { "TSTP", SIGTSTP },
+    { NULL, 0 }
+};
+
+static int parse_signal(const char *s) {
+    if (isdigit((unsigned char)*s)) return atoi(s);
+    if (strncmp(s, "SIG", 3) == 0) s += 3;
+    for (int i = 0; signames[i].name; ++i) {
+        if (strcmp(signames[i].name, s) == 0) return signames[i].sig;
+    }
+    return -1;
+}
+
+/* kill [-SIG | -s SIG] job|pid ... */
+static int builtin_kill(char **argv, FILE *out) {
+    int sig = SIGTERM, i = 1, status = 0;
+    if (argv[i] && strcmp(argv[i], "-l") == 0) {
+        for (int k = 0; signames[k].name; ++k) fprintf(out, "%2d) SIG%s\n", signames[k].sig, signames[k].name);
+        return 0;
+    }
+    if (argv[i] && strcmp(argv[i], "-s") == 0 && argv[i + 1]) { sig = parse_signal(argv[i + 1]); i += 2; }
+    else if (argv[i] && argv[i][0] == '-' && argv[i][1]) { sig = parse_signal(argv[i] + 1); i++; }
+    if (sig < 0) { fprintf(stderr, "kill: invalid signal specification\n"); return 1; }
+    if (!argv[i]) { fprintf(stderr, "kill: usage: kill [-s sigspec | -signum] pid | %%job ...\n"); return 1; }
+
+    for (; argv[i]; ++i) {
+        if (argv[i][0] == '%') {
+            job_t *j = parse_job_spec(argv[i]);
+            if (!j) { fprintf(stderr, "kill: %s: no such job\n", argv[i]); status = 1; continue; }
+            if (j->pgid) {
+                if (kill(-j->pgid, sig) == -1) { perror("kill"); status = 1; }
+            } else {
+                for (int k = 0; k < j->nprocs; ++k) {
+                    if (j->procs[k].state != PROC_DONE) kill(j->procs[k].pid, sig);
+                }
+            }
+            /* a stopped job must be woken to act on a terminating signal */
+            if (sig != SIGCONT && sig != SIGSTOP && job_stopped(j)) continue_job(j);
+        } else if (kill(atoi(argv[i]), sig) == -1) {
+            fprintf(stderr, "kill: (%s) - %s\n", argv[i], strerror(errno));
+            status = 1;
         }
-        remove_job(pid);
     }
-    /* if pid == 0 => no children have exited; if pid == -1 and errno==ECHILD => nothing to wait for */
+    return status;
+}
+
+/* Job-control builtins; returns 1 if argv was one of them */
+int jobs_builtin(char **argv, int *status, FILE *out) {
+    if (strcmp(argv[0], "jobs") == 0) {
+        print_jobs(out, argv[1] && strcmp(argv[1], "-l") == 0);
+        *status = 0;
+        return 1;
+    }
+    if (strcmp(argv[0], "fg") == 0) { *status = builtin_fg(argv, out); return 1; }
+    if (strcmp(argv[0], "bg") == 0) { *status = builtin_bg(argv, out); return 1; }
+    if (strcmp(argv[0], "wait") == 0) { *status = builtin_wait(argv); return 1; }
+    if (strcmp(argv[0], "kill") == 0) { *status = builtin_kill(argv, out); return 1; }
+    return 0;
 }
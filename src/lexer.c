@@ -0,0 +1,632 @@
+#include "shell.h"
+
+/*
+ * Single-pass lexer/parser.
+ *
+ * Compiles a command line into a list of AST nodes: pipelines (stages with
+ * their argv, '<' / '>' targets and '<<' / '<<<' input, optionally
+ * prefixed by `time` and optionally fanned out to `|> { consumer; ... }`
+ * pipelines), the compound commands if/elif/else, while/until and for,
+ * and function definitions `name() { list; }`. When a compound command is
+ * still open at the end of the line, further lines are pulled from the
+ * input source, so a block is parsed exactly once no matter how often its
+ * body runs.
+ *
+ * A here-document's body is read from the lines that follow the one that
+ * opened it, as soon as that line ends.
+ *
+ * Words are kept as raw source text, quotes included; quote removal and $
+ * expansion happen in expand_argv() each time a pipeline runs.
+ * Everything is allocated from the caller's arena.
+ */
+
+enum {
+    TOK_EOF,
+    TOK_WORD,
+    TOK_PIPE,   /* | */
+    TOK_FANOUT, /* |> */
+    TOK_LT,     /* < */
+    TOK_GT,     /* > */
+    TOK_HEREDOC, /* << or <<- */
+    TOK_HERESTR, /* <<< */
+    TOK_SEMI,   /* ; */
+    TOK_AMP,    /* & */
+    TOK_NEWLINE
+};
+
+typedef struct {
+    here_t *here;
+    char *delim;        /* quotes removed */
+    int strip_tabs;     /* <<- */
+} pending_here_t;
+
+typedef struct {
+    arena_t *a;
+    input_t *more;      /* where continuation lines come from (NULL: none) */
+    const char *p;      /* cursor in the current line */
+    int line_done;      /* end of the current line already reported */
+    int lines;          /* continuation lines fetched so far */
+    int depth;          /* compound commands still open */
+    int fanout;         /* |> { ... } groups open: '}' ends a pipeline */
+    int braces;         /* function bodies open: '}' ends a list */
+    pending_here_t *heres;  /* here-documents whose body follows this line */
+    int nheres, heres_cap;
+    int err;
+
+    int tok;            /* current token */
+    const char *start;  /* its text */
+    size_t len;
+} parser_t;
+
+static int is_meta(char c) {
+    return c == '|' || c == '<' || c == '>' || c == ';' || c == '&';
+}
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char *tok_name(const parser_t *ps) {
+    switch (ps->tok) {
+    case TOK_PIPE:    return "|";
+    case TOK_FANOUT:  return "|>";
+    case TOK_LT:      return "<";
+    case TOK_GT:      return ">";
+    case TOK_HEREDOC: return "<<";
+    case TOK_HERESTR: return "<<<";
+    case TOK_SEMI:    return ";";
+    case TOK_AMP:     return "&";
+    case TOK_NEWLINE: return "newline";
+    case TOK_EOF:     return "end of file";
+    default:          return NULL;
+    }
+}
+
+static void syntax_error(parser_t *ps) {
+    if (ps->err) return;
+    const char *name = tok_name(ps);
+    if (name) fprintf(stderr, "syntax error near unexpected token `%s'\n", name);
+    else fprintf(stderr, "syntax error near unexpected token `%.*s'\n", (int)ps->len, ps->start);
+    ps->err = 1;
+}
+
+/*
+ * Read the bodies of the here-documents opened on the line that just
+ * ended. rest is what follows that line in the current buffer; lines come
+ * from there first, then from the input source. Returns where parsing
+ * resumes.
+ */
+static const char *read_heredocs(parser_t *ps, const char *rest) {
+    for (int k = 0; k < ps->nheres; ++k) {
+        pending_here_t *h = &ps->heres[k];
+        size_t dlen = strlen(h->delim), len = 0, cap = 256;
+        char *body = malloc(cap);
+        while (1) {
+            const char *line;
+            size_t n;
+            if (*rest) {
+                const char *nl = strchr(rest, '\n');
+                line = rest;
+                n = nl ? (size_t)(nl - rest) : strlen(rest);
+                rest = nl ? nl + 1 : rest + n;
+            } else {
+                line = ps->more ? read_cmd(ps->more, "> ") : NULL;
+                if (!line) {
+                    fprintf(stderr, "warning: here-document delimited by end-of-file (wanted `%s')\n", h->delim);
+                    break;
+                }
+                n = strlen(line);
+                ps->line_done = 1;      /* the newline token for this line is being returned */
+            }
+            if (h->strip_tabs) {
+                while (n && *line == '\t') { line++; n--; }
+            }
+            if (n == dlen && memcmp(line, h->delim, n) == 0) break;
+            if (len + n + 2 > cap) {
+                while (len + n + 2 > cap) cap *= 2;
+                body = realloc(body, cap);
+            }
+            memcpy(body + len, line, n);
+            len += n;
+            body[len++] = '\n';
+        }
+        h->here->text = arena_strndup(ps->a, body, len);
+        free(body);
+    }
+    ps->nheres = 0;
+    return rest;
+}
+
+/* Read the next token into ps->tok; fetches another line when a compound command is open */
+static void advance(parser_t *ps) {
+    if (ps->err) { ps->tok = TOK_EOF; return; }
+    const char *p = ps->p;
+
+    while (1) {
+        while (is_blank(*p)) p++;
+        /* '#' at the start of a word comments out the rest of the line */
+        if (*p == '#') {
+            while (*p && *p != '\n') p++;
+        }
+        if (*p == '\n') {
+            ps->start = p;
+            ps->len = 1;
+            ps->p = p + 1;
+            ps->tok = TOK_NEWLINE;
+            if (ps->nheres) ps->p = read_heredocs(ps, p + 1);
+            return;
+        }
+        if (*p != '\0') break;
+
+        if (!ps->line_done) {
+            ps->line_done = 1;
+            ps->start = p;
+            ps->len = 0;
+            ps->p = p;
+            ps->tok = TOK_NEWLINE;
+            if (ps->nheres) read_heredocs(ps, p);
+            return;
+        }
+        char *line = (ps->depth > 0 && ps->more) ? read_cmd(ps->more, "> ") : NULL;
+        if (!line) {
+            ps->start = p;
+            ps->len = 0;
+            ps->p = p;
+            ps->tok = TOK_EOF;
+            return;
+        }
+        p = arena_strdup(ps->a, line);
+        ps->line_done = 0;
+        ps->lines++;
+    }
+
+    ps->start = p;
+    if (p[0] == '<' && p[1] == '<') {
+        ps->tok = p[2] == '<' ? TOK_HERESTR : TOK_HEREDOC;
+        ps->len = p[2] == '<' || p[2] == '-' ? 3 : 2;
+        ps->p = p + ps->len;
+        return;
+    }
+    if (p[0] == '|' && p[1] == '>') {
+        ps->tok = TOK_FANOUT;
+        ps->p = p + 2;
+        ps->len = 2;
+        return;
+    }
+    if (is_meta(*p)) {
+        ps->tok = *p == '|' ? TOK_PIPE : *p == '<' ? TOK_LT : *p == '>' ? TOK_GT
+                : *p == ';' ? TOK_SEMI : TOK_AMP;
+        ps->p = p + 1;
+        ps->len = 1;
+        return;
+    }
+
+    while (*p && !is_meta(*p) && !is_blank(*p) && *p != '\n') {
+        if (*p == '\\') {
+            if (p[1]) p += 2; else p++;
+        } else if ((*p == '$' && p[1] == '(') || *p == '`') {
+            const char *end = subst_end(p);
+            if (!end) {
+                fprintf(stderr, "syntax error: unexpected end of line while looking for matching `%c'\n",
+                        *p == '`' ? '`' : ')');
+                ps->err = 1;
+                ps->tok = TOK_EOF;
+                return;
+            }
+            p = end;
+        } else if (*p == '\'' || *p == '"') {
+            char q = *p++;
+            while (*p && *p != q) {
+                if (q == '"' && *p == '\\' && p[1]) p++;
+                else if (q == '"' && ((*p == '$' && p[1] == '(') || *p == '`')) {
+                    const char *end = subst_end(p);
+                    if (end) { p = end; continue; }
+                }
+                p++;
+            }
+            if (*p != q) {
+                fprintf(stderr, "syntax error: unexpected end of line while looking for matching `%c'\n", q);
+                ps->err = 1;
+                ps->tok = TOK_EOF;
+                return;
+            }
+            p++;
+        } else {
+            p++;
+        }
+    }
+    ps->len = p - ps->start;
+    ps->p = p;
+    ps->tok = TOK_WORD;
+}
+
+/* Skip a "..." string starting at p; returns its closing quote, NULL if unterminated */
+static const char *dquote_end(const char *p) {
+    for (p++; *p && *p != '"'; p++) {
+        if (*p == '\\' && p[1]) {
+            p++;
+        } else if ((*p == '$' && p[1] == '(') || *p == '`') {
+            const char *end = subst_end(p);
+            if (!end) return NULL;
+            p = end - 1;
+        }
+    }
+    return *p ? p : NULL;
+}
+
+const char *subst_end(const char *p) {
+    if (*p == '`') {
+        for (p++; *p && *p != '`'; p++) {
+            if (*p == '\\' && p[1]) p++;
+        }
+        return *p ? p + 1 : NULL;
+    }
+    /* $( ... ): parentheses nest; quoted ones and inner substitutions do not count */
+    int depth = 0;
+    for (p++; *p; p++) {
+        if (*p == '\\' && p[1]) {
+            p++;
+        } else if (*p == '\'') {
+            if (!(p = strchr(p + 1, '\''))) return NULL;
+        } else if (*p == '"') {
+            if (!(p = dquote_end(p))) return NULL;
+        } else if (*p == '`') {
+            const char *end = subst_end(p);
+            if (!end) return NULL;
+            p = end - 1;
+        } else if (*p == '(') {
+            depth++;
+        } else if (*p == ')' && --depth == 0) {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+/* Current token is the unquoted reserved word kw? */
+static int at_keyword(const parser_t *ps, const char *kw) {
+    size_t n = strlen(kw);
+    return ps->tok == TOK_WORD && ps->len == n && memcmp(ps->start, kw, n) == 0;
+}
+
+static int at_terminator(const parser_t *ps) {
+    return at_keyword(ps, "then") || at_keyword(ps, "elif") || at_keyword(ps, "else")
+        || at_keyword(ps, "fi") || at_keyword(ps, "do") || at_keyword(ps, "done")
+        || (ps->braces && at_keyword(ps, "}"));
+}
+
+static void expect_keyword(parser_t *ps, const char *kw) {
+    if (at_keyword(ps, kw)) advance(ps);
+    else syntax_error(ps);
+}
+
+/* Grow an arena array from cap to 2*cap elements (old storage is simply abandoned) */
+static void *grow(arena_t *a, void *old, int *cap, size_t elem) {
+    int ncap = *cap ? *cap * 2 : 8;
+    void *n = arena_alloc(a, ncap * elem);
+    if (old) memcpy(n, old, *cap * elem);
+    *cap = ncap;
+    return n;
+}
+
+static int starts_command(const parser_t *ps) {
+    return ps->tok == TOK_WORD || ps->tok == TOK_LT || ps->tok == TOK_GT
+        || ps->tok == TOK_HEREDOC || ps->tok == TOK_HERESTR;
+}
+
+static int stage_empty(const stage_t *s) {
+    return s->argc == 0 && !s->infile && !s->outfile && !s->here;
+}
+
+static node_t *new_node(parser_t *ps, int type) {
+    node_t *n = arena_alloc(ps->a, sizeof(node_t));
+    memset(n, 0, sizeof(node_t));
+    n->type = type;
+    return n;
+}
+
+/* << / <<- / <<< and its word (current token: the operator) */
+static void parse_here(parser_t *ps, stage_t *st) {
+    int doc = ps->tok == TOK_HEREDOC, strip = doc && ps->len == 3;
+    advance(ps);
+    if (ps->tok != TOK_WORD) { syntax_error(ps); return; }
+    here_t *h = arena_alloc(ps->a, sizeof(here_t));
+    st->here = h;
+    st->infile = NULL;
+    if (!doc) {
+        h->kind = HERE_STRING;
+        h->text = arena_strndup(ps->a, ps->start, ps->len);
+        return;
+    }
+    /* the delimiter is the word with its quotes removed; any quoting turns expansion off */
+    char *delim = arena_alloc(ps->a, ps->len + 1), *d = delim;
+    int quoted = 0;
+    for (size_t i = 0; i < ps->len; ++i) {
+        char c = ps->start[i];
+        if (c == '\'' || c == '"' || c == '\\') { quoted = 1; continue; }
+        *d++ = c;
+    }
+    *d = '\0';
+    h->kind = quoted ? HERE_DOC_QUOTED : HERE_DOC;
+    h->text = "";
+    if (ps->nheres == ps->heres_cap) ps->heres = grow(ps->a, ps->heres, &ps->heres_cap, sizeof(pending_here_t));
+    ps->heres[ps->nheres++] = (pending_here_t){ h, delim, strip };
+}
+
+static node_t *parse_list(parser_t *ps);
+static node_t *parse_pipeline(parser_t *ps);
+
+/* '|>' '{' pipeline ((';' | newline) pipeline)* [';'] '}'  (current token: |>) */
+static int parse_fanout(parser_t *ps, pipeline_t *pl, const char **end) {
+    int cap = 0;
+    ps->depth++;        /* the group may continue on the following lines */
+    advance(ps);
+    while (ps->tok == TOK_NEWLINE) advance(ps);
+    if (!at_keyword(ps, "{")) { syntax_error(ps); ps->depth--; return 0; }
+    ps->fanout++;
+    advance(ps);
+    while (!ps->err) {
+        if (ps->tok == TOK_SEMI || ps->tok == TOK_NEWLINE) {
+            advance(ps);
+            continue;
+        }
+        if (at_keyword(ps, "}")) break;
+        if (!starts_command(ps)) {
+            syntax_error(ps);
+            break;
+        }
+        node_t *n = parse_pipeline(ps);
+        if (!n) break;
+        if (pl->nfanout == cap) pl->fanout = grow(ps->a, pl->fanout, &cap, sizeof(pipeline_t));
+        pl->fanout[pl->nfanout++] = *n->pl;
+    }
+    ps->fanout--;
+    ps->depth--;
+    if (!ps->err && pl->nfanout == 0) syntax_error(ps);    /* { } */
+    if (ps->err) return 0;
+    *end = ps->start + ps->len;
+    advance(ps);
+    return 1;
+}
+
+/* stage ('|' stage)* ['|>' '{' ... '}'] ['&'] */
+static node_t *parse_pipeline(parser_t *ps) {
+    arena_t *a = ps->a;
+    int stages_cap = 0, words_cap = 0;
+    stage_t *stages = grow(a, NULL, &stages_cap, sizeof(stage_t));
+    memset(&stages[0], 0, sizeof(stage_t));
+    int nstages = 1;
+    const char *pl_start = ps->start, *pl_end = ps->start;
+
+    while (!ps->err) {
+        stage_t *st = &stages[nstages - 1];
+        if (ps->fanout && at_keyword(ps, "}")) {
+            break;
+        } else if (ps->tok == TOK_WORD) {
+            if (st->argc + 1 >= words_cap) st->argv = grow(a, st->argv, &words_cap, sizeof(char *));
+            st->argv[st->argc++] = arena_strndup(a, ps->start, ps->len);
+            st->argv[st->argc] = NULL;
+        } else if (ps->tok == TOK_LT || ps->tok == TOK_GT) {
+            char **target = (ps->tok == TOK_LT) ? &st->infile : &st->outfile;
+            advance(ps);
+            if (ps->tok != TOK_WORD) { syntax_error(ps); break; }
+            *target = arena_strndup(a, ps->start, ps->len);
+            if (target == &st->infile) st->here = NULL;
+        } else if (ps->tok == TOK_HEREDOC || ps->tok == TOK_HERESTR) {
+            parse_here(ps, st);
+            if (ps->err) break;
+        } else if (ps->tok == TOK_PIPE) {
+            if (stage_empty(st)) { syntax_error(ps); break; }
+            if (nstages >= stages_cap) stages = grow(a, stages, &stages_cap, sizeof(stage_t));
+            memset(&stages[nstages], 0, sizeof(stage_t));
+            nstages++;
+            words_cap = 0;
+        } else {
+            break;
+        }
+        pl_end = ps->start + ps->len;
+        advance(ps);
+    }
+    if (ps->err) return NULL;
+    if (stage_empty(&stages[nstages - 1])) { syntax_error(ps); return NULL; }
+
+    pipeline_t *pl = arena_alloc(a, sizeof(pipeline_t));
+    pl->stages = stages;
+    pl->nstages = nstages;
+    pl->background = 0;
+    pl->timed = 0;
+    pl->memo = 0;
+    pl->fanout = NULL;
+    pl->nfanout = 0;
+    if (ps->tok == TOK_FANOUT) {
+        int line = ps->lines;
+        const char *end = pl_end;
+        if (!parse_fanout(ps, pl, &end)) return NULL;
+        if (ps->lines == line) pl_end = end;    /* else the text stops at the producer */
+    }
+    pl->text = arena_strndup(a, pl_start, pl_end - pl_start);
+    if (ps->tok == TOK_AMP) {
+        if (ps->fanout) { syntax_error(ps); return NULL; }  /* consumers share the job */
+        pl->background = 1;
+        advance(ps);
+    }
+
+    node_t *n = new_node(ps, NODE_PIPELINE);
+    n->pl = pl;
+    return n;
+}
+
+/* if list then list [elif list then list]... [else list] fi  (current token: if/elif) */
+static node_t *parse_if(parser_t *ps) {
+    node_t *n = new_node(ps, NODE_IF);
+    advance(ps);
+    n->cond = parse_list(ps);
+    expect_keyword(ps, "then");
+    n->body = parse_list(ps);
+    if (ps->err) return NULL;
+    if (at_keyword(ps, "elif")) {
+        n->els = parse_if(ps);      /* consumes through the shared 'fi' */
+        return n;
+    }
+    if (at_keyword(ps, "else")) {
+        advance(ps);
+        n->els = parse_list(ps);
+    }
+    expect_keyword(ps, "fi");
+    return n;
+}
+
+/* while|until list do list done */
+static node_t *parse_while(parser_t *ps) {
+    node_t *n = new_node(ps, NODE_WHILE);
+    n->until = at_keyword(ps, "until");
+    advance(ps);
+    n->cond = parse_list(ps);
+    expect_keyword(ps, "do");
+    n->body = parse_list(ps);
+    expect_keyword(ps, "done");
+    return n;
+}
+
+/* for NAME [in word...] ; do list done */
+static node_t *parse_for(parser_t *ps) {
+    node_t *n = new_node(ps, NODE_FOR);
+    advance(ps);
+    if (ps->tok != TOK_WORD) { syntax_error(ps); return NULL; }
+    n->var = arena_strndup(ps->a, ps->start, ps->len);
+    advance(ps);
+
+    if (at_keyword(ps, "in")) {
+        int cap = 0;
+        advance(ps);
+        while (ps->tok == TOK_WORD) {
+            if (n->nwords + 1 >= cap) n->words = grow(ps->a, n->words, &cap, sizeof(char *));
+            n->words[n->nwords++] = arena_strndup(ps->a, ps->start, ps->len);
+            n->words[n->nwords] = NULL;
+            advance(ps);
+        }
+    }
+    while (ps->tok == TOK_SEMI || ps->tok == TOK_NEWLINE) advance(ps);
+    expect_keyword(ps, "do");
+    n->body = parse_list(ps);
+    expect_keyword(ps, "done");
+    return n;
+}
+
+/* `memo` followed by a command; `memo` alone or with an option is the builtin */
+static int memo_follows(const parser_t *ps) {
+    const char *p = ps->p;
+    while (is_blank(*p)) p++;
+    return *p && *p != '\n' && *p != '-' && *p != '#' && !is_meta(*p);
+}
+
+/* Length of NAME when the current word starts a definition: `NAME()`, `NAME ()` or `NAME(){` */
+static size_t funcdef_name(const parser_t *ps) {
+    if (ps->tok != TOK_WORD || !(isalpha((unsigned char)ps->start[0]) || ps->start[0] == '_')) return 0;
+    size_t n = 1;
+    while (n < ps->len && (isalnum((unsigned char)ps->start[n]) || ps->start[n] == '_')) n++;
+    const char *rest = ps->start + n;
+    size_t left = ps->len - n;
+    if (left == 2 || left == 3) return strncmp(rest, "(){", left) == 0 ? n : 0;
+    if (left) return 0;
+    const char *p = ps->p;
+    while (is_blank(*p)) p++;
+    return strncmp(p, "()", 2) == 0 && (!p[2] || p[2] == '{' || is_blank(p[2]) || p[2] == '\n') ? n : 0;
+}
+
+/* NAME() { list; }  (current token: the word holding NAME) */
+static node_t *parse_function(parser_t *ps, size_t name_len) {
+    node_t *n = new_node(ps, NODE_FUNCDEF);
+    n->var = arena_strndup(ps->a, ps->start, name_len);
+    int brace = ps->len == name_len + 3;      /* NAME(){ */
+    if (ps->len == name_len) advance(ps);       /* the separate () word */
+    advance(ps);
+    if (!brace) {
+        while (ps->tok == TOK_NEWLINE) advance(ps);
+        if (!at_keyword(ps, "{")) { syntax_error(ps); return NULL; }
+        advance(ps);
+    }
+    ps->braces++;
+    n->body = parse_list(ps);
+    ps->braces--;
+    if (!ps->err && !n->body) syntax_error(ps);     /* { } */
+    expect_keyword(ps, "}");
+    return n;
+}
+
+static node_t *parse_command(parser_t *ps) {
+    node_t *n;
+    size_t name_len;
+    if (at_keyword(ps, "if")) {
+        ps->depth++;
+        n = parse_if(ps);
+        ps->depth--;
+    } else if (at_keyword(ps, "while") || at_keyword(ps, "until")) {
+        ps->depth++;
+        n = parse_while(ps);
+        ps->depth--;
+    } else if (at_keyword(ps, "for")) {
+        ps->depth++;
+        n = parse_for(ps);
+        ps->depth--;
+    } else if ((name_len = funcdef_name(ps)) != 0) {
+        ps->depth++;        /* the body may continue on the following lines */
+        n = parse_function(ps, name_len);
+        ps->depth--;
+    } else if (at_keyword(ps, "time")) {
+        /* time pipeline: reported per stage when it finishes */
+        advance(ps);
+        n = parse_pipeline(ps);
+        if (n) n->pl->timed = 1;
+        return n;
+    } else if (at_keyword(ps, "memo") && memo_follows(ps)) {
+        /* memo pipeline: answered from the memo cache when it can be */
+        advance(ps);
+        n = parse_pipeline(ps);
+        if (n) n->pl->memo = 1;
+        return n;
+    } else {
+        return parse_pipeline(ps);
+    }
+    if (ps->tok == TOK_AMP) syntax_error(ps);   /* no background compound commands */
+    return ps->err ? NULL : n;
+}
+
+/* Commands separated by ';', '&' and newlines, up to a reserved word that closes
+   the enclosing compound (or the end of the line at top level) */
+static node_t *parse_list(parser_t *ps) {
+    node_t *head = NULL, **tail = &head;
+    while (!ps->err) {
+        if (ps->tok == TOK_SEMI || (ps->tok == TOK_NEWLINE && ps->depth > 0)) {
+            advance(ps);
+            continue;
+        }
+        if (ps->tok == TOK_EOF || ps->tok == TOK_NEWLINE || at_terminator(ps)) break;
+        if (!starts_command(ps)) {
+            syntax_error(ps);
+            break;
+        }
+        node_t *n = parse_command(ps);
+        if (!n) break;
+        *tail = n;
+        tail = &n->next;
+    }
+    return ps->err ? NULL : head;
+}
+
+node_t *parse_segments(arena_t *a, const char *cmdline, input_t *more, int *err) {
+    parser_t ps = { .a = a, .more = more };
+    if (err) *err = 0;
+    if (!cmdline) return NULL;
+
+    /* our own copy: the caller's line buffer is reused for continuation lines */
+    ps.p = arena_strdup(a, cmdline);
+    advance(&ps);
+    node_t *list = parse_list(&ps);
+    if (!ps.err && ps.tok != TOK_NEWLINE && ps.tok != TOK_EOF) syntax_error(&ps);
+    if (ps.err) {
+        if (err) *err = 1;
+        return NULL;
+    }
+    return list;
+}
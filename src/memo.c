@@ -0,0 +1,272 @@
+#define _GNU_SOURCE     /* memfd_create */
+#include "shell.h"
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+/*
+ * memo PIPELINE: run a pipeline once and answer later runs of it from a
+ * cache of its stdout and exit status.
+ *
+ * The key is the expanded words of every stage, the current directory,
+ * any here-document text, and the identity (device, inode, size, mtime)
+ * of the first stage's '<' file and of every stage's executable as found
+ * on $PATH. Editing the input, installing a new binary or cd'ing elsewhere
+ * therefore misses; anything else the command reads is the caller's
+ * business. A hit copies the stored memfd to the output with sendfile(2)
+ * and launches nothing.
+ *
+ * Entries are kept in LRU order under a byte budget, $MEMOSIZE (K and M
+ * suffixes allowed, 16M by default). A run killed by a signal, or whose
+ * output alone exceeds the budget, is not stored. `memo` lists the cache
+ * and `memo -c` empties it.
+ */
+
+#define MEMO_BUCKETS 256
+#define MEMO_DEFAULT_BUDGET (16L * 1024 * 1024)
+
+typedef struct memo_entry_s {
+    char *key;
+    size_t keylen;
+    unsigned long hash;
+    char *text;                 /* the pipeline, for listings */
+    int fd;                     /* memfd holding the output */
+    off_t size;
+    int status;
+    unsigned long hits;
+    struct memo_entry_s *chain; /* next in the hash bucket */
+    struct memo_entry_s *newer, *older;
+} memo_entry_t;
+
+static memo_entry_t *buckets[MEMO_BUCKETS];
+static memo_entry_t *newest, *oldest;
+static size_t cached_bytes;
+
+/* Key under construction */
+typedef struct {
+    char *s;
+    size_t len, cap;
+} memo_key_t;
+
+static void key_put(memo_key_t *k, const void *p, size_t n) {
+    if (k->len + n > k->cap) {
+        while (k->len + n > k->cap) k->cap = k->cap ? k->cap * 2 : 256;
+        k->s = realloc(k->s, k->cap);
+    }
+    memcpy(k->s + k->len, p, n);
+    k->len += n;
+}
+
+static void key_str(memo_key_t *k, const char *s) {
+    key_put(k, s, strlen(s) + 1);   /* the NUL keeps "ab","c" apart from "a","bc" */
+}
+
+/* Add path's identity; -1 if it cannot be stat'd */
+static int key_file(memo_key_t *k, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    struct { dev_t dev; ino_t ino; off_t size; struct timespec mtime; } id;
+    memset(&id, 0, sizeof(id));     /* no padding bytes in the key */
+    id.dev = st.st_dev;
+    id.ino = st.st_ino;
+    id.size = st.st_size;
+    id.mtime = st.st_mtim;
+    key_put(k, &id, sizeof(id));
+    return 0;
+}
+
+/* Build pl's key; -1 if it cannot be memoized (the pipeline then just runs) */
+static int build_key(const pipeline_t *pl, memo_key_t *k) {
+    char cwd[4096];
+    if (pl->background || pl->nfanout || !getcwd(cwd, sizeof(cwd))) return -1;
+    key_str(k, cwd);
+    for (int i = 0; i < pl->nstages; ++i) {
+        const stage_t *st = &pl->stages[i];
+        if (!st->argv || !st->argv[0]) return -1;
+        key_put(k, "\x01", 1);      /* stage separator */
+        for (int j = 0; st->argv[j]; ++j) key_str(k, st->argv[j]);
+        if (is_builtin(st->argv[0])) {
+            key_str(k, "(builtin)");
+        } else {
+            const char *path = strchr(st->argv[0], '/') ? st->argv[0] : hash_lookup(st->argv[0]);
+            if (!path || key_file(k, path) != 0) return -1;     /* let it fail normally */
+        }
+        if (i == 0 && st->infile && !st->here) {
+            key_put(k, "<", 1);
+            if (key_file(k, st->infile) != 0) return -1;
+        }
+        if (st->here) {
+            key_put(k, st->here->kind == HERE_STRING ? "<<<" : "<<", st->here->kind == HERE_STRING ? 3 : 2);
+            key_str(k, st->here->text);
+        }
+    }
+    return 0;
+}
+
+static unsigned long hash_key(const char *s, size_t n) {
+    unsigned long h = 1469598103934665603UL;  /* FNV-1a */
+    for (size_t i = 0; i < n; ++i) { h ^= (unsigned char)s[i]; h *= 1099511628211UL; }
+    return h;
+}
+
+static long budget(void) {
+    const char *v = get_var("MEMOSIZE");
+    if (!v || !*v) return MEMO_DEFAULT_BUDGET;
+    char *end;
+    long n = strtol(v, &end, 10);
+    if (*end == 'k' || *end == 'K') n *= 1024;
+    else if (*end == 'm' || *end == 'M') n *= 1024 * 1024;
+    return n > 0 ? n : 0;
+}
+
+static void lru_unlink(memo_entry_t *e) {
+    if (e->newer) e->newer->older = e->older;
+    else newest = e->older;
+    if (e->older) e->older->newer = e->newer;
+    else oldest = e->newer;
+    e->newer = e->older = NULL;
+}
+
+static void lru_push(memo_entry_t *e) {
+    e->older = newest;
+    e->newer = NULL;
+    if (newest) newest->newer = e;
+    newest = e;
+    if (!oldest) oldest = e;
+}
+
+static void entry_drop(memo_entry_t *e) {
+    memo_entry_t **pp = &buckets[e->hash % MEMO_BUCKETS];
+    while (*pp != e) pp = &(*pp)->chain;
+    *pp = e->chain;
+    lru_unlink(e);
+    cached_bytes -= e->size;
+    close(e->fd);
+    free(e->key);
+    free(e->text);
+    free(e);
+}
+
+static memo_entry_t *lookup(const memo_key_t *k, unsigned long h) {
+    for (memo_entry_t *e = buckets[h % MEMO_BUCKETS]; e; e = e->chain) {
+        if (e->hash == h && e->keylen == k->len && memcmp(e->key, k->s, k->len) == 0) return e;
+    }
+    return NULL;
+}
+
+/* Copy the whole of memfd fd to out */
+static void replay(int fd, off_t size, int out) {
+    off_t off = 0;
+    while (off < size) {
+        ssize_t n = sendfile(out, fd, &off, size - off);
+        if (n > 0) continue;
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && (errno == EINVAL || errno == ENOSYS)) {
+            /* an output sendfile cannot write to (e.g. opened O_APPEND) */
+            char buf[65536];
+            ssize_t r;
+            while ((r = pread(fd, buf, sizeof(buf), off)) > 0) {
+                if (write(out, buf, r) != r) break;
+                off += r;
+            }
+        }
+        break;
+    }
+}
+
+/* Send the output to the last stage's '>' file or to stdout */
+static int deliver(const pipeline_t *pl, int fd, off_t size) {
+    const char *outfile = pl->stages[pl->nstages - 1].outfile;
+    if (!outfile) {
+        fflush(stdout);
+        replay(fd, size, STDOUT_FILENO);
+        return 0;
+    }
+    int out = open(outfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out == -1) {
+        fprintf(stderr, "open outfile: %s: %s\n", outfile, strerror(errno));
+        return -1;
+    }
+    replay(fd, size, out);
+    close(out);
+    return 0;
+}
+
+int memo_run(const pipeline_t *pl) {
+    memo_key_t k = { 0 };
+    if (build_key(pl, &k) != 0) {
+        free(k.s);
+        return execute_pipeline(pl);
+    }
+    unsigned long h = hash_key(k.s, k.len);
+    memo_entry_t *e = lookup(&k, h);
+    if (e) {
+        free(k.s);
+        e->hits++;
+        lru_unlink(e);
+        lru_push(e);
+        stats_count(CTR_MEMO_HITS);
+        time_mark_t tm;
+        if (pl->timed) time_mark(&tm);
+        int status = deliver(pl, e->fd, e->size) == 0 ? e->status : 1;
+        if (pl->timed) time_report(pl->text, &tm);
+        return status;
+    }
+
+    int fd = memfd_create("memo", MFD_CLOEXEC);
+    if (fd == -1) {
+        perror("memo: memfd_create");
+        free(k.s);
+        return execute_pipeline(pl);
+    }
+    /* the output goes to the cache first; the '>' file gets it afterwards */
+    pipeline_t run = *pl;
+    run.stages = malloc(sizeof(stage_t) * pl->nstages);
+    memcpy(run.stages, pl->stages, sizeof(stage_t) * pl->nstages);
+    run.stages[pl->nstages - 1].outfile = NULL;
+    stats_count(CTR_PIPELINES);
+    int status = job_wait(launch_pipeline(&run, JOB_FOREGROUND, fd));
+    free(run.stages);
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (deliver(pl, fd, size) != 0) status = 1;
+    long limit = budget();
+    if (status >= 128 || size > limit) {
+        close(fd);
+        free(k.s);
+        return status;
+    }
+    while (oldest && cached_bytes + size > (size_t)limit) entry_drop(oldest);
+
+    e = calloc(1, sizeof(memo_entry_t));
+    e->key = k.s;
+    e->keylen = k.len;
+    e->hash = h;
+    e->text = strdup(pl->text ? pl->text : "(pipeline)");
+    e->fd = fd;
+    e->size = size;
+    e->status = status;
+    e->chain = buckets[h % MEMO_BUCKETS];
+    buckets[h % MEMO_BUCKETS] = e;
+    lru_push(e);
+    cached_bytes += size;
+    return status;
+}
+
+/* memo [-c]: list the cache, newest first, or empty it */
+int memo_builtin(char **argv, FILE *out) {
+    if (argv[1] && strcmp(argv[1], "-c") == 0 && !argv[2]) {
+        while (oldest) entry_drop(oldest);
+        return 0;
+    }
+    if (argv[1]) {
+        fprintf(stderr, "memo: usage: memo PIPELINE | memo [-c]\n");
+        return 2;
+    }
+    if (!newest) { fprintf(out, "memo: cache empty\n"); return 0; }
+    fprintf(out, "hits\tbytes\tstatus\tpipeline\n");
+    for (memo_entry_t *e = newest; e; e = e->older)
+        fprintf(out, "%4lu\t%lld\t%d\t%s\n", e->hits, (long long)e->size, e->status, e->text);
+    fprintf(out, "%zu bytes in use of %ld\n", cached_bytes, budget());
+    return 0;
+}
@@ -0,0 +1,196 @@
+#define _GNU_SOURCE     /* memfd_create */
+#include "shell.h"
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+/*
+ * parallel [-j N] command [arg...] [::: item...]
+ *
+ * Runs the command once per item (the ::: list, or one item per line of
+ * stdin) with at most N tasks alive at a time, N defaulting to the number
+ * of online CPUs. "{}" in the command is replaced by the item; without it
+ * the item is appended as the last argument.
+ *
+ * Each task is an owned job launched through launch_pipeline() with its
+ * stdout captured in a memfd. The scheduler sleeps on the job table's
+ * SIGCHLD event, starts a new task as soon as one finishes, and prints the
+ * captured output strictly in item order, so the result reads exactly like
+ * the serial loop it replaces. stderr is not captured.
+ *
+ * Finished tasks keep their memfd until their turn to print, so behind one
+ * slow task at most PARALLEL_WINDOW * N tasks are launched but unprinted;
+ * open fds and buffered output stay bounded however long the item list.
+ */
+
+#define PARALLEL_WINDOW 2
+
+typedef struct {
+    const char *item;
+    job_t *job;         /* NULL once collected */
+    int out_fd;         /* captured stdout, -1 once printed */
+    int status;
+    int done;
+} task_t;
+
+/* word with every "{}" replaced by item */
+static char *substitute(arena_t *a, const char *word, const char *item) {
+    size_t wl = strlen(word), il = strlen(item), n = 0;
+    for (const char *p = word; (p = strstr(p, "{}")); p += 2) n++;
+    char *out = arena_alloc(a, wl + n * il + 1), *o = out;
+    const char *p = word, *q;
+    while ((q = strstr(p, "{}"))) {
+        memcpy(o, p, q - p); o += q - p;
+        memcpy(o, item, il); o += il;
+        p = q + 2;
+    }
+    strcpy(o, p);
+    return out;
+}
+
+/* Build the task's argv and command text, then launch it with stdout in a memfd */
+static void launch_task(arena_t *a, char **tmpl, int ntmpl, int has_slot, task_t *t) {
+    arena_mark_t mark;
+    arena_mark(a, &mark);
+
+    int argc = ntmpl + !has_slot;
+    char **argv = arena_alloc(a, sizeof(char *) * (argc + 1));
+    size_t textlen = 0;
+    for (int i = 0; i < ntmpl; ++i) argv[i] = has_slot ? substitute(a, tmpl[i], t->item) : tmpl[i];
+    if (!has_slot) argv[ntmpl] = (char *)t->item;
+    argv[argc] = NULL;
+    for (int i = 0; i < argc; ++i) textlen += strlen(argv[i]) + 1;
+    char *text = arena_alloc(a, textlen + 1), *o = text;
+    for (int i = 0; i < argc; ++i) o += sprintf(o, i ? " %s" : "%s", argv[i]);
+
+    t->out_fd = memfd_create("parallel", MFD_CLOEXEC);
+    if (t->out_fd == -1) {
+        perror("parallel: memfd_create");
+        t->done = 1;
+        t->status = 1;
+    } else {
+        stage_t st = { .argv = argv, .argc = argc };
+        pipeline_t pl = { .stages = &st, .nstages = 1, .text = text };
+        t->job = launch_pipeline(&pl, JOB_OWNED, t->out_fd);
+    }
+    arena_release(a, &mark);
+}
+
+/* Copy a finished task's captured output to stdout and release it */
+static void flush_task(task_t *t, int out_fd) {
+    if (t->out_fd < 0) return;
+    off_t size = lseek(t->out_fd, 0, SEEK_END), off = 0;
+    while (off < size) {
+        ssize_t n = sendfile(out_fd, t->out_fd, &off, size - off);
+        if (n > 0) continue;
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && (errno == EINVAL || errno == ENOSYS)) {
+            /* stdout that sendfile cannot write to (e.g. opened O_APPEND) */
+            char buf[65536];
+            ssize_t r;
+            lseek(t->out_fd, off, SEEK_SET);
+            while ((r = read(t->out_fd, buf, sizeof(buf))) > 0) {
+                if (write(out_fd, buf, r) != r) break;
+            }
+        }
+        break;
+    }
+    close(t->out_fd);
+    t->out_fd = -1;
+}
+
+/* Items from stdin, one per line */
+static char **read_items(int in_fd, int *nitems) {
+    input_t *in = input_open_fd(dup(in_fd));     /* input_close() closes it */
+    int cap = 64, n = 0;
+    char **items = malloc(sizeof(char *) * cap);
+    char *line;
+    while ((line = read_cmd(in, NULL)) != NULL) {
+        if (n == cap) items = realloc(items, sizeof(char *) * (cap *= 2));
+        items[n++] = strdup(line);
+    }
+    input_close(in);
+    *nitems = n;
+    return items;
+}
+
+int parallel_builtin(char **argv, int in_fd, FILE *out) {
+    long maxjobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int i = 1;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1] == 'j'; ++i) {
+        const char *n = argv[i][2] ? argv[i] + 2 : argv[++i];
+        if (!n || (maxjobs = atol(n)) < 1) {
+            fprintf(stderr, "parallel: -j: expected a positive number\n");
+            return 2;
+        }
+    }
+    if (maxjobs < 1) maxjobs = 1;
+
+    char **tmpl = argv + i;
+    int ntmpl = 0, has_slot = 0;
+    while (tmpl[ntmpl] && strcmp(tmpl[ntmpl], ":::") != 0) {
+        if (strstr(tmpl[ntmpl], "{}")) has_slot = 1;
+        ntmpl++;
+    }
+    if (ntmpl == 0) {
+        fprintf(stderr, "parallel: usage: parallel [-j N] command [arg...] [::: item...]\n");
+        return 2;
+    }
+
+    int nitems;
+    char **items, **owned = NULL;
+    if (tmpl[ntmpl]) {
+        items = tmpl + ntmpl + 1;
+        for (nitems = 0; items[nitems]; ++nitems) ;
+    } else {
+        items = owned = read_items(in_fd, &nitems);
+    }
+
+    fflush(out);     /* captured output goes straight to out's fd */
+    task_t *tasks = calloc(nitems ? nitems : 1, sizeof(task_t));
+    arena_t a;
+    arena_init(&a);
+    int next_launch = 0, next_print = 0, running = 0, failed = 0;
+    long window = PARALLEL_WINDOW * maxjobs;
+
+    while (next_print < nitems) {
+        while (running < maxjobs && next_launch < nitems && next_launch - next_print < window) {
+            task_t *t = &tasks[next_launch++];
+            t->item = items[next_launch - 1];
+            launch_task(&a, tmpl, ntmpl, has_slot, t);
+            if (t->job) running++;
+        }
+
+        jobs_reap();
+        int collected = 0;
+        for (int k = next_print; k < next_launch; ++k) {
+            task_t *t = &tasks[k];
+            if (t->job && job_collect(t->job, &t->status)) {
+                t->job = NULL;
+                t->done = 1;
+                running--;
+                collected++;
+            }
+        }
+
+        /* output goes out in item order; later tasks wait for the ones before them */
+        while (next_print < next_launch && tasks[next_print].done) {
+            task_t *t = &tasks[next_print++];
+            flush_task(t, fileno(out));
+            if (t->status != 0) {
+                fprintf(stderr, "parallel: task %d (%s) exited with status %d\n", next_print, t->item, t->status);
+                failed++;
+            }
+        }
+        if (!collected && running > 0) jobs_wait_event();
+    }
+
+    if (failed) fprintf(stderr, "parallel: %d of %d tasks failed\n", failed, nitems);
+    arena_free(&a);
+    free(tasks);
+    if (owned) {
+        for (int k = 0; k < nitems; ++k) free(owned[k]);
+        free(owned);
+    }
+    /* like GNU parallel: the number of failed tasks, capped at 101 */
+    return failed > 101 ? 101 : failed;
+}
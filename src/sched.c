@@ -0,0 +1,254 @@
+#define _GNU_SOURCE     /* cpu_set_t, sched_setaffinity */
+#include "shell.h"
+#include <sched.h>
+#include <sys/resource.h>
+
+/*
+ * Stage controls: words in front of a pipeline stage that change how its
+ * process runs, applied in the child between fork and exec.
+ *
+ *   pin CPUS            CPU affinity, e.g. pin 0-3,6
+ *   nice [-n N | -N]    lower the priority by N (10 by default)
+ *   sched POLICY[:PRIO] other, batch, idle, fifo or rr
+ *   ulimit -X N ...     resource limits, as the ulimit builtin takes them
+ *
+ * They combine (`pin 2 nice 5 cmd`) and apply to one stage only, so
+ * `pin 0 producer | pin 1 consumer` keeps the two ends on neighbouring
+ * cores without a taskset exec per stage. launch_stage() strips them,
+ * records them with the stage in the job table for `jobs -l`, and sends
+ * the stage through fork: posix_spawn() has no way to express them.
+ *
+ * Without a command, `ulimit` is an ordinary builtin that shows or sets
+ * the shell's own limits.
+ */
+
+typedef struct {
+    char opt;
+    int resource;
+    int unit;           /* bytes per unit of the value written */
+    const char *name;
+} limit_def_t;
+
+static const limit_def_t limit_defs[] = {
+    { 'c', RLIMIT_CORE,    1024, "core file size (kbytes)" },
+    { 'd', RLIMIT_DATA,    1024, "data seg size (kbytes)" },
+    { 'f', RLIMIT_FSIZE,   1024, "file size (kbytes)" },
+    { 'l', RLIMIT_MEMLOCK, 1024, "max locked memory (kbytes)" },
+    { 'm', RLIMIT_RSS,     1024, "max memory size (kbytes)" },
+    { 'n', RLIMIT_NOFILE,  1,    "open files" },
+    { 's', RLIMIT_STACK,   1024, "stack size (kbytes)" },
+    { 't', RLIMIT_CPU,     1,    "cpu time (seconds)" },
+    { 'u', RLIMIT_NPROC,   1,    "max user processes" },
+    { 'v', RLIMIT_AS,      1024, "virtual memory (kbytes)" },
+    { 0, 0, 0, NULL }
+};
+
+static const struct { const char *name; int policy; } policies[] = {
+    { "other", SCHED_OTHER }, { "batch", SCHED_BATCH }, { "idle", SCHED_IDLE },
+    { "fifo", SCHED_FIFO }, { "rr", SCHED_RR }, { NULL, 0 }
+};
+
+static const limit_def_t *limit_def(const char *word) {
+    if (word[0] != '-' || !word[1] || word[2]) return NULL;
+    for (int i = 0; limit_defs[i].opt; ++i) {
+        if (limit_defs[i].opt == word[1]) return &limit_defs[i];
+    }
+    return NULL;
+}
+
+/* "unlimited" or a number of def's units; -1 if neither */
+static int parse_limit(const limit_def_t *def, const char *s, int *unlimited, unsigned long long *value) {
+    if (strcmp(s, "unlimited") == 0) { *unlimited = 1; *value = 0; return 0; }
+    char *end;
+    if (!isdigit((unsigned char)*s)) return -1;
+    unsigned long long n = strtoull(s, &end, 10);
+    if (*end) return -1;
+    *unlimited = 0;
+    *value = n * def->unit;
+    return 0;
+}
+
+static int is_number(const char *s) {
+    if (*s == '-' || *s == '+') s++;
+    if (!*s) return 0;
+    while (isdigit((unsigned char)*s)) s++;
+    return *s == '\0';
+}
+
+/* Does `ulimit` at argv[0] carry a command after its options? */
+static int ulimit_has_command(char **argv) {
+    int i = 1;
+    while (argv[i] && limit_def(argv[i])) {
+        i++;
+        if (argv[i] && (is_number(argv[i]) || strcmp(argv[i], "unlimited") == 0)) i++;
+    }
+    return argv[i] && argv[i][0] != '-';     /* -a and the like are the builtin's */
+}
+
+int stage_prefixed(char **argv) {
+    if (!argv || !argv[0]) return 0;
+    if (strcmp(argv[0], "ulimit") == 0) return ulimit_has_command(argv);
+    return strcmp(argv[0], "pin") == 0 || strcmp(argv[0], "nice") == 0 || strcmp(argv[0], "sched") == 0;
+}
+
+/* "0-3,6" into ctl->cpus; -1 if malformed */
+static int parse_cpus(const char *s, stage_ctl_t *ctl) {
+    memset(ctl->cpus, 0, sizeof(ctl->cpus));
+    while (*s) {
+        char *end;
+        if (!isdigit((unsigned char)*s)) return -1;
+        long lo = strtol(s, &end, 10), hi = lo;
+        if (*end == '-') {
+            if (!isdigit((unsigned char)end[1])) return -1;
+            hi = strtol(end + 1, &end, 10);
+        }
+        if (hi < lo || hi >= CTL_MAX_CPUS) return -1;
+        for (long c = lo; c <= hi; ++c) ctl->cpus[c / (8 * sizeof(unsigned long))] |= 1UL << (c % (8 * sizeof(unsigned long)));
+        if (*end == ',') end++;
+        else if (*end) return -1;
+        s = end;
+    }
+    return 0;
+}
+
+/* Append "word arg" to the description, written as the prefix was */
+static void describe(stage_ctl_t *ctl, const char *word, const char *arg) {
+    size_t n = strlen(ctl->desc);
+    snprintf(ctl->desc + n, sizeof(ctl->desc) - n, "%s%s %s", n ? " " : "", word, arg);
+}
+
+int stage_controls(char **argv, stage_ctl_t *ctl) {
+    int i = 0;
+    memset(ctl, 0, sizeof(*ctl));
+    ctl->policy = -1;
+    while (argv[i] && stage_prefixed(argv + i)) {
+        const char *kw = argv[i++];
+        if (strcmp(kw, "pin") == 0) {
+            if (!argv[i] || parse_cpus(argv[i], ctl) != 0) {
+                fprintf(stderr, "pin: %s: expected a CPU list such as 0-3,6\n", argv[i] ? argv[i] : "(none)");
+                return -1;
+            }
+            ctl->pinned = 1;
+            describe(ctl, "pin", argv[i++]);
+        } else if (strcmp(kw, "nice") == 0) {
+            const char *n = "10";
+            if (argv[i] && strcmp(argv[i], "-n") == 0) {
+                n = argv[i + 1];
+                i += 2;
+                if (!n || !is_number(n)) { fprintf(stderr, "nice: -n: expected a number\n"); return -1; }
+            } else if (argv[i] && argv[i][0] == '-' && is_number(argv[i])) {
+                n = argv[i++] + 1;
+            }
+            ctl->niced = 1;
+            ctl->nice = atoi(n);
+            describe(ctl, "nice", n);
+        } else if (strcmp(kw, "sched") == 0) {
+            const char *spec = argv[i];
+            int k = 0;
+            size_t len = spec ? strcspn(spec, ":") : 0;
+            while (spec && policies[k].name && (strlen(policies[k].name) != len || strncmp(policies[k].name, spec, len) != 0)) k++;
+            if (!spec || !policies[k].name || (spec[len] && !is_number(spec + len + 1))) {
+                fprintf(stderr, "sched: %s: expected other, batch, idle, fifo or rr, with :PRIORITY for fifo and rr\n",
+                        spec ? spec : "(none)");
+                return -1;
+            }
+            ctl->policy = policies[k].policy;
+            ctl->priority = spec[len] ? atoi(spec + len + 1) : 0;
+            if ((ctl->policy == SCHED_FIFO || ctl->policy == SCHED_RR) && !spec[len]) ctl->priority = 1;
+            describe(ctl, "sched", argv[i++]);
+        } else {
+            while (argv[i] && limit_def(argv[i])) {
+                const limit_def_t *def = limit_def(argv[i]);
+                if (!argv[i + 1] || ctl->nlimits == CTL_MAX_LIMITS ||
+                    parse_limit(def, argv[i + 1], &ctl->limits[ctl->nlimits].unlimited,
+                                &ctl->limits[ctl->nlimits].value) != 0) {
+                    fprintf(stderr, "ulimit: %s: expected a number or unlimited\n", argv[i]);
+                    return -1;
+                }
+                ctl->limits[ctl->nlimits++].resource = def->resource;
+                char opt[64];
+                snprintf(opt, sizeof(opt), "%s %s", argv[i], argv[i + 1]);
+                describe(ctl, "ulimit", opt);
+                i += 2;
+            }
+        }
+    }
+    if (!argv[i]) {
+        fprintf(stderr, "%s: missing command\n", argv[0]);
+        return -1;
+    }
+    return i;
+}
+
+/* Set the soft limit; in a child (raise_hard) also lift the hard one if needed */
+static int set_limit(int resource, int unlimited, unsigned long long value, int raise_hard) {
+    struct rlimit rl;
+    getrlimit(resource, &rl);
+    rl.rlim_cur = unlimited ? RLIM_INFINITY : (rlim_t)value;
+    if (raise_hard && rl.rlim_max != RLIM_INFINITY && (unlimited || rl.rlim_cur > rl.rlim_max))
+        rl.rlim_max = rl.rlim_cur;
+    if (setrlimit(resource, &rl) != 0) {
+        perror("ulimit");
+        if (raise_hard) _exit(126);
+        return 1;
+    }
+    return 0;
+}
+
+void apply_stage_ctl(const stage_ctl_t *ctl) {
+    if (ctl->pinned) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int c = 0; c < CTL_MAX_CPUS && c < CPU_SETSIZE; ++c) {
+            if (ctl->cpus[c / (8 * sizeof(unsigned long))] & (1UL << (c % (8 * sizeof(unsigned long)))))
+                CPU_SET(c, &set);
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) { perror("pin"); _exit(126); }
+    }
+    if (ctl->policy >= 0) {
+        struct sched_param sp = { .sched_priority = ctl->priority };
+        if (sched_setscheduler(0, ctl->policy, &sp) != 0) { perror("sched"); _exit(126); }
+    }
+    if (ctl->niced) {
+        errno = 0;
+        if (nice(ctl->nice) == -1 && errno) { perror("nice"); _exit(126); }
+    }
+    for (int i = 0; i < ctl->nlimits; ++i)
+        set_limit(ctl->limits[i].resource, ctl->limits[i].unlimited, ctl->limits[i].value, 1);
+}
+
+static void print_limit(FILE *out, const limit_def_t *def, int with_name) {
+    struct rlimit rl;
+    if (getrlimit(def->resource, &rl) != 0) { perror("ulimit"); return; }
+    if (with_name) fprintf(out, "%-30s (-%c) ", def->name, def->opt);
+    if (rl.rlim_cur == RLIM_INFINITY) fprintf(out, "unlimited\n");
+    else fprintf(out, "%llu\n", (unsigned long long)rl.rlim_cur / def->unit);
+}
+
+/* ulimit [-a] [-X [N]]...: show or set the shell's soft limits (-f by default) */
+int ulimit_builtin(char **argv, FILE *out) {
+    if (argv[1] && strcmp(argv[1], "-a") == 0) {
+        for (int i = 0; limit_defs[i].opt; ++i) print_limit(out, &limit_defs[i], 1);
+        return 0;
+    }
+    if (!argv[1]) { print_limit(out, limit_def("-f"), 0); return 0; }
+    for (int i = 1; argv[i]; ++i) {
+        const limit_def_t *def = limit_def(argv[i]);
+        if (!def) {
+            fprintf(stderr, "ulimit: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+        if (!argv[i + 1] || limit_def(argv[i + 1])) {
+            print_limit(out, def, argv[2] != NULL);
+            continue;
+        }
+        int unlimited;
+        unsigned long long value;
+        if (parse_limit(def, argv[++i], &unlimited, &value) != 0) {
+            fprintf(stderr, "ulimit: %s: expected a number or unlimited\n", argv[i]);
+            return 1;
+        }
+        if (set_limit(def->resource, unlimited, value, 0) != 0) return 1;
+    }
+    return 0;
+}
@@ -1,196 +1,284 @@
 #include "shell.h"
 
 #include <readline/readline.h>
-#include <readline/history.h>
-#include <strings.h>
 #include <ctype.h>
 
 
-char* read_cmd(char* prompt, FILE* fp) {
-    if (fp == stdin && isatty(fileno(stdin))) {
-        char *line = readline(prompt);
-        if (!line) return NULL; /* Ctrl-D */
-        return line;            /* caller must free */
+/* Up/down walk the shell's own history store rather than readline's list */
+static long hist_nav = 0;           /* number being shown, 0: the line being typed */
+static char *hist_saved = NULL;     /* the line being typed, while browsing */
+
+static void history_step(int dir) {
+    long first = history_first(), last = history_last();
+    long n = hist_nav ? hist_nav + dir : (dir < 0 ? last : 0);
+    if (n < first || n == 0) { rl_ding(); return; }
+    if (!hist_nav) { free(hist_saved); hist_saved = strdup(rl_line_buffer); }
+    if (n > last) {
+        rl_replace_line(hist_saved ? hist_saved : "", 0);
+        hist_nav = 0;
+    } else {
+        size_t len;
+        const char *s = history_at(n, &len);
+        char *line = strndup(s, len);
+        rl_replace_line(line, 0);
+        free(line);
+        hist_nav = n;
     }
+    rl_point = rl_end;
+}
+
+static int history_up(int count, int key) {
+    (void)key;
+    while (count-- > 0) history_step(-1);
+    return 0;
+}
+
+static int history_down(int count, int key) {
+    (void)key;
+    while (count-- > 0) history_step(1);
+    return 0;
+}
+
+/*
+ * Ctrl-R: incremental reverse search over the history store (its trigram
+ * index, see histindex.c). While searching, keys go through search_map.
+ */
+static Keymap search_map, search_saved_map;
+static char search_pat[256];
+static size_t search_len = 0;
+static long search_hit = 0;         /* entry shown, 0 if none yet */
+static int search_failed = 0;
+static char *search_orig = NULL;    /* line to restore on C-g */
+
+static void search_show(void) {
+    rl_message("(%sreverse-i-search)`%s': ", search_failed ? "failed " : "", search_pat);
+}
+
+/* Look for the pattern in entries older than `before` and show the hit */
+static void search_from(long before) {
+    long n = search_len ? history_find(search_pat, before) : 0;
+    search_failed = search_len && !n;
+    if (n) {
+        size_t len;
+        const char *s = history_at(n, &len);
+        char *line = strndup(s, len);
+        rl_replace_line(line, 0);
+        rl_point = strstr(line, search_pat) - line;
+        free(line);
+        search_hit = n;
+    }
+    search_show();
+}
+
+static void search_leave(int restore) {
+    if (restore) rl_replace_line(search_orig ? search_orig : "", 0);
+    rl_set_keymap(search_saved_map);
+    rl_restore_prompt();
+    rl_clear_message();
+    hist_nav = search_hit && !restore ? search_hit : 0;
+}
 
-    printf("%s", prompt);
-    char *buf = malloc(MAX_LEN);
-    int c, pos = 0;
-    while ((c = getc(fp)) != EOF && c != '\n') {
-        if (pos < MAX_LEN - 1) buf[pos++] = c;
+static int search_start(int count, int key) {
+    (void)count; (void)key;
+    if (rl_get_keymap() == search_map) {
+        /* C-r again: next older match */
+        search_from(search_hit ? search_hit : history_last() + 1);
+        return 0;
     }
-    if (c == EOF && pos == 0) { free(buf); return NULL; }
-    buf[pos] = '\0';
-    return buf;
+    free(search_orig);
+    search_orig = strdup(rl_line_buffer);
+    search_pat[0] = '\0';
+    search_len = 0;
+    search_hit = 0;
+    search_failed = 0;
+    search_saved_map = rl_get_keymap();
+    rl_set_keymap(search_map);
+    rl_save_prompt();
+    search_show();
+    return 0;
 }
 
+static int search_insert(int count, int key) {
+    (void)count;
+    if (search_len + 1 >= sizeof(search_pat)) { rl_ding(); return 0; }
+    search_pat[search_len++] = (char)key;
+    search_pat[search_len] = '\0';
+    /* the current hit may still match the longer pattern */
+    search_from(search_hit ? search_hit + 1 : history_last() + 1);
+    return 0;
+}
+
+static int search_backspace(int count, int key) {
+    (void)count; (void)key;
+    if (search_len) search_pat[--search_len] = '\0';
+    search_hit = 0;
+    search_from(history_last() + 1);
+    return 0;
+}
+
+static int search_abort(int count, int key) {
+    (void)count; (void)key;
+    search_leave(1);
+    return 0;
+}
+
+static int search_accept(int count, int key) {
+    search_leave(0);
+    return rl_newline(count, key);
+}
+
+/* Any editing key ends the search with the match left in the line */
+static int search_edit(int count, int key) {
+    search_leave(0);
+    if (key == CTRL('A')) return rl_beg_of_line(count, key);
+    if (key == CTRL('E')) return rl_end_of_line(count, key);
+    if (key == CTRL('B')) return rl_backward_char(count, key);
+    if (key == CTRL('F')) return rl_forward_char(count, key);
+    return 0;
+}
+
+static void init_search_map(void) {
+    search_map = rl_make_bare_keymap();
+    for (int c = ' '; c < 127; ++c) rl_bind_key_in_map(c, search_insert, search_map);
+    rl_bind_key_in_map(127, search_backspace, search_map);
+    rl_bind_key_in_map(CTRL('H'), search_backspace, search_map);
+    rl_bind_key_in_map(CTRL('R'), search_start, search_map);
+    rl_bind_key_in_map(CTRL('G'), search_abort, search_map);
+    rl_bind_key_in_map('\r', search_accept, search_map);
+    rl_bind_key_in_map('\n', search_accept, search_map);
+    rl_bind_key_in_map(CTRL('A'), search_edit, search_map);
+    rl_bind_key_in_map(CTRL('E'), search_edit, search_map);
+    rl_bind_key_in_map(CTRL('B'), search_edit, search_map);
+    rl_bind_key_in_map(CTRL('F'), search_edit, search_map);
+    rl_bind_keyseq_in_map("\\e[C", search_edit, search_map);
+    rl_bind_keyseq_in_map("\\e[D", search_edit, search_map);
+}
+
+/* each new line starts outside the history */
+static int history_reset(void) {
+    hist_nav = 0;
+    return 0;
+}
 
 void init_readline(void) {
     rl_bind_key('\t', rl_complete);
+    rl_startup_hook = history_reset;
+    rl_bind_keyseq("\\e[A", history_up);
+    rl_bind_keyseq("\\e[B", history_down);
+    rl_bind_keyseq("\\eOA", history_up);
+    rl_bind_keyseq("\\eOB", history_down);
+    rl_bind_key(CTRL('P'), history_up);
+    rl_bind_key(CTRL('N'), history_down);
+    init_search_map();
+    rl_bind_key(CTRL('R'), search_start);
+    init_completion();
 }
 
 
-char** tokenize(char* cmdline) {
-    if (cmdline == NULL) return NULL;
-    /* trim trailing newline if present */
-    size_t L = strlen(cmdline);
-    if (L > 0 && cmdline[L-1] == '\n') cmdline[L-1] = '\0';
 
-    /* empty check */
-    char *tmp = cmdline;
-    while (*tmp == ' ' || *tmp == '\t') tmp++;
-    if (*tmp == '\0') return NULL;
+/* Names handled by handle_builtin() */
+static const char *builtin_names[] = {
+    "[", "bg", "break", "cd", "continue", "echo", "exit", "fg", "hash", "help", "history", "jobs", "kill", "local",
+    "memo", "parallel", "return", "set", "stats", "tee", "test", "ulimit", "wait", NULL
+};
 
-    char** arglist = malloc(sizeof(char*) * (MAXARGS + 1));
-    for (int i = 0; i < MAXARGS + 1; i++) {
-        arglist[i] = malloc(ARGLEN);
-        bzero(arglist[i], ARGLEN);
+int is_builtin(const char *name) {
+    if (!name) return 0;
+    for (int i = 0; builtin_names[i]; ++i) {
+        if (strcmp(builtin_names[i], name) == 0) return 1;
     }
+    return 0;
+}
 
-    char* cp = cmdline;
-    char* start;
-    int argnum = 0;
-
-    while (*cp != '\0' && argnum < MAXARGS) {
-        while (*cp == ' ' || *cp == '\t') cp++; // skip
-        if (*cp == '\0') break;
-        start = cp;
-        while (*cp && *cp != ' ' && *cp != '\t') cp++;
-        int len = cp - start;
-        if (len >= ARGLEN) len = ARGLEN - 1;
-        strncpy(arglist[argnum], start, len);
-        arglist[argnum][len] = '\0';
-        argnum++;
-    }
+/* The i-th builtin name, NULL past the end */
+const char *builtin_at(int i) {
+    return i >= 0 && i < (int)(sizeof(builtin_names) / sizeof(builtin_names[0])) ? builtin_names[i] : NULL;
+}
 
-    if (argnum == 0) {
-        for (int i = 0; i < MAXARGS + 1; i++) free(arglist[i]);
-        free(arglist);
-        return NULL;
+/* echo [-n] [word...] */
+static int builtin_echo(char **argv, FILE *out) {
+    int i = 1, newline = 1;
+    if (argv[1] && strcmp(argv[1], "-n") == 0) { newline = 0; i++; }
+    for (; argv[i]; ++i) {
+        fputs(argv[i], out);
+        if (argv[i + 1]) fputc(' ', out);
     }
-    arglist[argnum] = NULL;
-    return arglist;
+    if (newline) fputc('\n', out);
+    return 0;
 }
 
+/* history [N] | history -s PATTERN */
+static int builtin_history(char **argv, FILE *out) {
+    if (!argv[1]) { print_history(out, 0); return 0; }
+    if (strcmp(argv[1], "-s") != 0) { print_history(out, atol(argv[1])); return 0; }
+    if (!argv[2]) { fprintf(stderr, "history: -s: pattern expected\n"); return 2; }
+
+    /* matches come newest first; print them oldest first like the full listing */
+    long *hits = NULL;
+    size_t n = 0, cap = 0;
+    for (long at = history_find(argv[2], history_last() + 1); at; at = history_find(argv[2], at)) {
+        if (n == cap) hits = realloc(hits, sizeof(long) * (cap = cap ? cap * 2 : 64));
+        hits[n++] = at;
+    }
+    for (size_t i = n; i-- > 0; ) {
+        size_t len;
+        const char *s = history_at(hits[i], &len);
+        fprintf(out, "%5ld\t%.*s\n", hits[i], (int)len, s);
+    }
+    free(hits);
+    return n ? 0 : 1;
+}
 
-extern void print_history(void);
+/* set: list variables; set -o/+o pipefail toggles the option */
+static int builtin_set(char **argv, FILE *out) {
+    if (!argv[1]) { print_vars(out); return 0; }
+    if ((strcmp(argv[1], "-o") == 0 || strcmp(argv[1], "+o") == 0)) {
+        int on = argv[1][0] == '-';
+        if (!argv[2]) { fprintf(out, "pipefail\t%s\n", get_pipefail() ? "on" : "off"); return 0; }
+        if (strcmp(argv[2], "pipefail") == 0) { set_pipefail(on); return 0; }
+        fprintf(stderr, "set: %s: invalid option name\n", argv[2]);
+        return 1;
+    }
+    fprintf(stderr, "set: usage: set [-o|+o pipefail]\n");
+    return 2;
+}
 
-int handle_builtin(char **arglist) {
+/* Run arglist if it is a builtin, reading from in_fd and writing to out */
+int handle_builtin(char **arglist, int *status, int in_fd, FILE *out) {
     if (arglist == NULL || arglist[0] == NULL) return 0;
-    if (strcmp(arglist[0], "exit") == 0) { free_history(); exit(0); }
+    *status = 0;
+    if (strcmp(arglist[0], "exit") == 0) {
+        int code = arglist[1] ? atoi(arglist[1]) : last_status;
+        free_history();
+        exit(code);
+    }
     if (strcmp(arglist[0], "cd") == 0) {
-        if (arglist[1] == NULL) fprintf(stderr, "cd: missing argument\n");
-        else if (chdir(arglist[1]) != 0) perror("cd");
+        if (arglist[1] == NULL) { fprintf(stderr, "cd: missing argument\n"); *status = 1; }
+        else if (chdir(arglist[1]) != 0) { perror("cd"); *status = 1; }
         return 1;
     }
     if (strcmp(arglist[0], "help") == 0) {
-        printf("Built-in commands: cd, exit, help, history, jobs, set\n"); return 1;
+        fprintf(out, "Built-in commands: [, bg, break, cd, continue, echo, exit, fg, hash, help, history, jobs, kill, local, memo, parallel, return, set, stats, tee, test, ulimit, wait\n");
+        fprintf(out, "Stage prefixes:    pin CPUS, nice [-n N], sched POLICY[:PRIO], ulimit -X N (e.g. pin 0 producer | pin 1 consumer)\n");
+        fprintf(out, "Compound commands: if/elif/else/fi, while/until ... do ... done, for NAME in ...; do ... done, time PIPELINE,\n"
+                     "                   memo PIPELINE, PIPELINE |> { PIPELINE; PIPELINE ... }\n");
+        fprintf(out, "Functions:         NAME() { LIST; } defines NAME; a call sees its arguments as $1..$9 ${10} $# $@ $*\n");
+        return 1;
     }
-    if (strcmp(arglist[0], "history") == 0) { print_history(); return 1; }
-    if (strcmp(arglist[0], "jobs") == 0) { printf("jobs: not implemented yet\n"); return 1; }
+    /* a lone break/continue/return is run_pipeline()'s; in a stage or subshell there is nothing to leave */
+    if (strcmp(arglist[0], "break") == 0 || strcmp(arglist[0], "continue") == 0) return 1;
+    if (strcmp(arglist[0], "return") == 0) { *status = arglist[1] ? atoi(arglist[1]) & 255 : last_status; return 1; }
+    if (strcmp(arglist[0], "echo") == 0) { *status = builtin_echo(arglist, out); return 1; }
+    if (strcmp(arglist[0], "local") == 0) { *status = local_builtin(arglist); return 1; }
+    if (strcmp(arglist[0], "test") == 0 || strcmp(arglist[0], "[") == 0) { *status = test_builtin(arglist); return 1; }
+    if (strcmp(arglist[0], "hash") == 0) { *status = hash_builtin(arglist, out); return 1; }
+    if (strcmp(arglist[0], "history") == 0) { *status = builtin_history(arglist, out); return 1; }
+    if (strcmp(arglist[0], "memo") == 0) { *status = memo_builtin(arglist, out); return 1; }
+    if (strcmp(arglist[0], "parallel") == 0) { *status = parallel_builtin(arglist, in_fd, out); return 1; }
+    if (strcmp(arglist[0], "stats") == 0) { *status = stats_builtin(arglist, out); return 1; }
+    if (strcmp(arglist[0], "tee") == 0) { *status = tee_builtin(arglist, in_fd, out); return 1; }
+    if (strcmp(arglist[0], "ulimit") == 0) { *status = ulimit_builtin(arglist, out); return 1; }
+    if (strcmp(arglist[0], "set") == 0) { *status = builtin_set(arglist, out); return 1; }
+    if (jobs_builtin(arglist, status, out)) return 1;
     return 0;
 }
-
-int parse_segments(const char *cmdline,
-                   char ****cmds_argv_out,
-                   char ***infiles_out,
-                   char ***outfiles_out)
-{
-    if (!cmdline) return 0;
-
-    /* make a modifiable copy */
-    char *copy = strdup(cmdline);
-    char *saveptr = NULL;
-    int maxseg = 16;
-    char **segments = malloc(sizeof(char*) * maxseg);
-    int n = 0;
-
-    char *tok = strtok_r(copy, "|", &saveptr);
-    while (tok) {
-        /* trim leading/trailing spaces */
-        while (*tok == ' ' || *tok == '\t') tok++;
-        char *end = tok + strlen(tok) - 1;
-        while (end > tok && (*end == ' ' || *end == '\t')) { *end = '\0'; end--; }
-
-        if (n >= maxseg) {
-            maxseg *= 2;
-            segments = realloc(segments, sizeof(char*) * maxseg);
-        }
-        segments[n++] = strdup(tok);
-        tok = strtok_r(NULL, "|", &saveptr);
-    }
-    free(copy);
-
-    if (n == 0) { free(segments); return 0; }
-
-
-    char ***cmds_argv = malloc(sizeof(char**) * n);
-    char **infiles = malloc(sizeof(char*) * n);
-    char **outfiles = malloc(sizeof(char*) * n);
-    for (int i = 0; i < n; ++i) { infiles[i] = NULL; outfiles[i] = NULL; cmds_argv[i] = NULL; }
-
-
-    for (int i = 0; i < n; ++i) {
-        char *seg = segments[i];
-
-        char *buf = strdup(seg);
-        char *p = buf;
-        char *words[ MAXARGS + 10 ];
-        int w = 0;
-
-
-        while (*p) {
-            while (*p == ' ' || *p == '\t') p++;
-            if (*p == '\0') break;
-            if (*p == '<' || *p == '>') {
-                char s[2] = {*p, '\0'}; words[w++] = strdup(s); p++; continue;
-            }
-            char *start = p;
-            while (*p && *p != ' ' && *p != '\t' && *p != '<' && *p != '>') p++;
-            int len = p - start;
-            char *wstr = malloc(len+1);
-            strncpy(wstr, start, len); wstr[len] = '\0';
-            words[w++] = wstr;
-        }
-
-
-        char *cmdbuf = malloc(MAX_LEN);
-        cmdbuf[0] = '\0';
-        int cmd_written = 0;
-        for (int j = 0; j < w; ++j) {
-            if (strcmp(words[j], "<") == 0) {
-                if (j+1 < w) {
-                    infiles[i] = strdup(words[j+1]); j++;
-                }
-            } else if (strcmp(words[j], ">") == 0) {
-                if (j+1 < w) {
-                    outfiles[i] = strdup(words[j+1]); j++;
-                }
-            } else {
-
-                if (cmd_written) strncat(cmdbuf, " ", MAX_LEN - strlen(cmdbuf) - 1);
-                strncat(cmdbuf, words[j], MAX_LEN - strlen(cmdbuf) - 1);
-                cmd_written = 1;
-            }
-        }
-
-
-        if (cmd_written) {
-            cmds_argv[i] = tokenize(cmdbuf);
-        } else {
-            cmds_argv[i] = NULL;
-        }
-
-
-        for (int j = 0; j < w; ++j) free(words[j]);
-        free(buf);
-        free(cmdbuf);
-        free(segments[i]);
-    }
-    free(segments);
-
-    *cmds_argv_out = cmds_argv;
-    *infiles_out = infiles;
-    *outfiles_out = outfiles;
-    return n;
-}
@@ -0,0 +1,229 @@
+#include "shell.h"
+#include <spawn.h>
+#include <signal.h>
+
+extern char **environ;
+
+/*
+ * Process launch engine.
+ *
+ * The normal path is posix_spawn(): glibc implements it with
+ * clone(CLONE_VM|CLONE_VFORK), so the child shares our address space until
+ * it execs and no page tables are copied, however large the shell grows.
+ * Redirections and pipe wiring are expressed as spawn file actions, the
+ * job's process group and default signal dispositions as spawn attributes.
+ *
+ * fork() is kept as a fallback for requests posix_spawn cannot express
+ * (stage controls such as `pin`) or for libcs that report it as
+ * unsupported.
+ */
+
+/* Stop signals the interactive shell ignores; commands get the defaults back */
+static const int job_signals[] = { SIGTSTP, SIGTTIN, SIGTTOU, SIGINT, SIGQUIT };
+
+static void reset_job_signals(void) {
+    for (size_t i = 0; i < sizeof(job_signals) / sizeof(job_signals[0]); ++i)
+        signal(job_signals[i], SIG_DFL);
+}
+
+/* Child side of a fork: apply the spawn actions by hand */
+static void wire_child(const spawn_req_t *req) {
+    if (req->in_fd >= 0) dup2(req->in_fd, STDIN_FILENO);
+    else if (req->infile) {
+        int fd = open(req->infile, O_RDONLY);
+        if (fd == -1) { perror("open infile"); _exit(1); }
+        dup2(fd, STDIN_FILENO); close(fd);
+    }
+    if (req->out_fd >= 0) dup2(req->out_fd, STDOUT_FILENO);
+    else if (req->outfile) {
+        int fd = open(req->outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) { perror("open outfile"); _exit(1); }
+        dup2(fd, STDOUT_FILENO); close(fd);
+    }
+    for (int i = 0; i < req->nclose; ++i) close(req->close_fds[i]);
+    if (req->setpgid) setpgid(0, req->pgid);
+
+    /* the shell keeps SIGCHLD blocked for its signalfd; the command must not inherit that */
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    reset_job_signals();
+    if (req->ctl) apply_stage_ctl(req->ctl);
+}
+
+/* Child side of the fork fallback */
+static void fork_child(const spawn_req_t *req, const char *path) {
+    wire_child(req);
+    execv(path, req->argv);
+    perror("execv");
+    _exit(1);
+}
+
+static pid_t spawn_fork(const spawn_req_t *req, const char *path) {
+    stats_count(CTR_FORK_FALLBACK);
+    pid_t pid = fork();
+    if (pid == -1) { perror("fork"); return -1; }
+    if (pid == 0) fork_child(req, path);
+    return pid;
+}
+
+/* Print a diagnostic for a failed posix_spawn, naming the redirection if that is what failed */
+static void report_spawn_error(const spawn_req_t *req, int err) {
+    if (req->in_fd < 0 && req->infile && access(req->infile, R_OK) != 0) {
+        fprintf(stderr, "open infile: %s: %s\n", req->infile, strerror(errno));
+        return;
+    }
+    if (req->out_fd < 0 && req->outfile && err != ENOENT && err != EACCES) {
+        fprintf(stderr, "open outfile: %s: %s\n", req->outfile, strerror(err));
+        return;
+    }
+    fprintf(stderr, "%s: %s\n", req->argv[0], strerror(err));
+}
+
+static pid_t spawn_command(const spawn_req_t *req) {
+
+    /* resolve through the command hash unless the name is already a path */
+    const char *cmd = req->argv[0];
+    const char *path = cmd;
+    int hashed = strchr(cmd, '/') == NULL;
+    if (hashed && !(path = hash_lookup(cmd))) {
+        fprintf(stderr, "%s: command not found\n", cmd);
+        stats_count(CTR_NOT_FOUND);
+        return -1;
+    }
+
+    /* affinity, nice and limits have no spawn attribute */
+    if (req->ctl) return spawn_fork(req, path);
+
+    posix_spawn_file_actions_t fa;
+    if (posix_spawn_file_actions_init(&fa) != 0) return spawn_fork(req, path);
+
+    int rc = 0;
+    if (req->in_fd >= 0)
+        rc |= posix_spawn_file_actions_adddup2(&fa, req->in_fd, STDIN_FILENO);
+    else if (req->infile)
+        rc |= posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, req->infile, O_RDONLY, 0);
+    if (req->out_fd >= 0)
+        rc |= posix_spawn_file_actions_adddup2(&fa, req->out_fd, STDOUT_FILENO);
+    else if (req->outfile)
+        rc |= posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, req->outfile,
+                                               O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    for (int i = 0; i < req->nclose; ++i)
+        rc |= posix_spawn_file_actions_addclose(&fa, req->close_fds[i]);
+
+    if (rc != 0) {
+        posix_spawn_file_actions_destroy(&fa);
+        return spawn_fork(req, path);
+    }
+
+    /* the shell keeps SIGCHLD blocked for its signalfd; the command must not inherit that */
+    posix_spawnattr_t attr;
+    sigset_t none;
+    sigemptyset(&none);
+    if (posix_spawnattr_init(&attr) != 0) {
+        posix_spawn_file_actions_destroy(&fa);
+        return spawn_fork(req, path);
+    }
+    sigset_t dfl;
+    sigemptyset(&dfl);
+    for (size_t i = 0; i < sizeof(job_signals) / sizeof(job_signals[0]); ++i)
+        sigaddset(&dfl, job_signals[i]);
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &dfl);
+    if (req->setpgid) {
+        /* join the job's process group before exec, so no signal can miss a stage */
+        posix_spawnattr_setpgroup(&attr, req->pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    pid_t pid;
+    int err = posix_spawn(&pid, path, &fa, &attr, req->argv, environ);
+    if (err == ENOENT && hashed && access(path, X_OK) != 0) {
+        /* cached location went stale: forget it and search PATH once more */
+        hash_forget(cmd);
+        if ((path = hash_lookup(cmd)) != NULL)
+            err = posix_spawn(&pid, path, &fa, &attr, req->argv, environ);
+    }
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+
+    if (!path) { fprintf(stderr, "%s: command not found\n", cmd); stats_count(CTR_NOT_FOUND); return -1; }
+    if (err == ENOSYS || err == EINVAL) return spawn_fork(req, path);
+    if (err != 0) { report_spawn_error(req, err); return -1; }
+    return pid;
+}
+
+pid_t spawn_process(const spawn_req_t *req) {
+    if (!req || !req->argv || !req->argv[0]) return -1;
+    uint64_t t0 = stats_now();
+    pid_t pid = spawn_command(req);
+    stats_record(STAT_SPAWN, t0);
+    stats_count(pid == -1 ? CTR_SPAWN_FAILS : CTR_SPAWNS);
+    return pid;
+}
+
+/* Run a builtin or a function in a forked subshell wired like a spawned command */
+pid_t spawn_builtin(const spawn_req_t *req) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) { perror("fork"); return -1; }
+    if (pid == 0) {
+        int status = 1;
+        wire_child(req);
+        if (!handle_builtin(req->argv, &status, STDIN_FILENO, stdout)) {
+            arena_t a;
+            arena_init(&a);
+            jobs_subshell();    /* the function's own commands stay in this stage's group */
+            status = call_function(&a, req->argv);
+        }
+        fflush(stdout);
+        _exit(status);
+    }
+    return pid;
+}
+
+/* Fan-out stage: a forked child copying its stdin to every fd of outs */
+pid_t spawn_tee(const spawn_req_t *req, const int *outs, int nout) {
+    pid_t pid = fork();
+    if (pid == -1) { perror("fork"); return -1; }
+    if (pid == 0) {
+        wire_child(req);
+        _exit(tee_fds(STDIN_FILENO, outs, nout, -1));
+    }
+    return pid;
+}
+
+/* Run a builtin in the shell itself, wired as req describes (no fds: the shell's own stdio) */
+int run_builtin(const spawn_req_t *req, int timed) {
+    int in = req->in_fd, out = req->out_fd, status = 1;
+    if (in < 0 && req->infile && (in = open(req->infile, O_RDONLY | O_CLOEXEC)) == -1) {
+        fprintf(stderr, "open infile: %s: %s\n", req->infile, strerror(errno));
+        return 1;
+    }
+    if (out < 0 && req->outfile &&
+        (out = open(req->outfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+        fprintf(stderr, "open outfile: %s: %s\n", req->outfile, strerror(errno));
+        if (in != req->in_fd) close(in);
+        return 1;
+    }
+
+    FILE *f = stdout;
+    if (out >= 0) {
+        /* a private copy, so fclose() leaves the caller's fd open */
+        int fd = fcntl(out, F_DUPFD_CLOEXEC, 0);
+        f = fd >= 0 ? fdopen(fd, "w") : NULL;
+        if (!f) { perror("fdopen"); if (fd >= 0) close(fd); }
+    }
+    if (f) {
+        stats_count(CTR_BUILTINS);
+        int in_fd = in >= 0 ? in : STDIN_FILENO;
+        if (timed) timed_builtin(req->argv, &status, in_fd, f);
+        else handle_builtin(req->argv, &status, in_fd, f);
+        if (f != stdout) fclose(f);
+    }
+    if (in != req->in_fd) close(in);
+    if (out != req->out_fd) close(out);
+    return status;
+}
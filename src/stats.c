@@ -0,0 +1,135 @@
+#include "shell.h"
+#include <time.h>
+
+/*
+ * Always-on counters and latency histograms for the shell's own hot paths.
+ *
+ * Each timer keeps a count, a total, a maximum and a log2 histogram of
+ * nanoseconds (bucket k holds samples in [2^k, 2^(k+1))), so recording a
+ * sample is a clock read, a bit scan and three adds -- cheap enough to leave
+ * on for every command. `stats` prints them, `stats -j` dumps JSON and
+ * `stats -r` starts over.
+ */
+
+#define STAT_BUCKETS 64
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t hist[STAT_BUCKETS];
+} stat_timer_t;
+
+static stat_timer_t timers[STAT_NTIMERS];
+static uint64_t counters[STAT_NCOUNTERS];
+
+static const char *timer_names[STAT_NTIMERS] = {
+    [STAT_READ]   = "read_wait",
+    [STAT_LINE]   = "line_run",
+    [STAT_PARSE]  = "parse",
+    [STAT_EXPAND] = "expand",
+    [STAT_SPAWN]  = "spawn",
+    [STAT_WAIT]   = "wait",
+};
+
+static const char *counter_names[STAT_NCOUNTERS] = {
+    [CTR_LINES]         = "lines",
+    [CTR_PIPELINES]     = "pipelines",
+    [CTR_BUILTINS]      = "builtins",
+    [CTR_SPAWNS]        = "spawns",
+    [CTR_SPAWN_FAILS]   = "spawn_failures",
+    [CTR_FORK_FALLBACK] = "fork_fallbacks",
+    [CTR_NOT_FOUND]     = "not_found",
+    [CTR_MEMO_HITS]     = "memo_hits",
+};
+
+uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+void stats_record(int timer, uint64_t start_ns) {
+    uint64_t ns = stats_now() - start_ns;
+    stat_timer_t *t = &timers[timer];
+    t->count++;
+    t->total_ns += ns;
+    if (ns > t->max_ns) t->max_ns = ns;
+    t->hist[ns ? 63 - __builtin_clzll(ns) : 0]++;
+}
+
+void stats_count(int counter) {
+    counters[counter]++;
+}
+
+/* Upper bound of the bucket holding the q-th quantile (never above the max) */
+static uint64_t quantile(const stat_timer_t *t, double q) {
+    uint64_t want = (uint64_t)(t->count * q), seen = 0;
+    for (int k = 0; k < STAT_BUCKETS; ++k) {
+        seen += t->hist[k];
+        if (seen > want) {
+            uint64_t bound = k >= 63 ? UINT64_MAX : (2ull << k) - 1;
+            return bound < t->max_ns ? bound : t->max_ns;
+        }
+    }
+    return t->max_ns;
+}
+
+/* Human-readable duration: ns, us, ms or s with 3 significant-ish digits */
+static void fmt_ns(char *buf, size_t n, uint64_t ns) {
+    if (ns < 1000) snprintf(buf, n, "%lluns", (unsigned long long)ns);
+    else if (ns < 1000000) snprintf(buf, n, "%.1fus", ns / 1e3);
+    else if (ns < 1000000000) snprintf(buf, n, "%.1fms", ns / 1e6);
+    else snprintf(buf, n, "%.2fs", ns / 1e9);
+}
+
+static void print_text(FILE *out) {
+    fprintf(out, "%-10s %10s %10s %10s %10s %10s %10s\n", "timer", "count", "total", "avg", "p50<=", "p99<=", "max");
+    for (int i = 0; i < STAT_NTIMERS; ++i) {
+        const stat_timer_t *t = &timers[i];
+        char tot[32], avg[32], p50[32], p99[32], max[32];
+        fmt_ns(tot, sizeof(tot), t->total_ns);
+        fmt_ns(avg, sizeof(avg), t->count ? t->total_ns / t->count : 0);
+        fmt_ns(p50, sizeof(p50), t->count ? quantile(t, 0.50) : 0);
+        fmt_ns(p99, sizeof(p99), t->count ? quantile(t, 0.99) : 0);
+        fmt_ns(max, sizeof(max), t->max_ns);
+        fprintf(out, "%-10s %10llu %10s %10s %10s %10s %10s\n", timer_names[i],
+               (unsigned long long)t->count, tot, avg, p50, p99, max);
+    }
+    for (int i = 0; i < STAT_NCOUNTERS; ++i)
+        fprintf(out, "%-16s %llu\n", counter_names[i], (unsigned long long)counters[i]);
+}
+
+static void print_json(FILE *out) {
+    fprintf(out, "{\"counters\":{");
+    for (int i = 0; i < STAT_NCOUNTERS; ++i)
+        fprintf(out, "%s\"%s\":%llu", i ? "," : "", counter_names[i], (unsigned long long)counters[i]);
+    fprintf(out, "},\"timers\":{");
+    for (int i = 0; i < STAT_NTIMERS; ++i) {
+        const stat_timer_t *t = &timers[i];
+        fprintf(out, "%s\"%s\":{\"count\":%llu,\"total_ns\":%llu,\"max_ns\":%llu,\"log2_ns_hist\":{",
+               i ? "," : "", timer_names[i], (unsigned long long)t->count,
+               (unsigned long long)t->total_ns, (unsigned long long)t->max_ns);
+        int first = 1;
+        for (int k = 0; k < STAT_BUCKETS; ++k) {
+            if (!t->hist[k]) continue;
+            fprintf(out, "%s\"%d\":%llu", first ? "" : ",", k, (unsigned long long)t->hist[k]);
+            first = 0;
+        }
+        fprintf(out, "}}");
+    }
+    fprintf(out, "}}\n");
+}
+
+/* stats [-j | -r] */
+int stats_builtin(char **argv, FILE *out) {
+    if (!argv[1]) { print_text(out); return 0; }
+    if (strcmp(argv[1], "-j") == 0) { print_json(out); return 0; }
+    if (strcmp(argv[1], "-r") == 0) {
+        memset(timers, 0, sizeof(timers));
+        memset(counters, 0, sizeof(counters));
+        return 0;
+    }
+    fprintf(stderr, "stats: usage: stats [-j | -r]\n");
+    return 2;
+}
@@ -0,0 +1,195 @@
+#define _GNU_SOURCE     /* tee, splice */
+#include "shell.h"
+#include <signal.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+/*
+ * Fan-out without user-space copies.
+ *
+ * tee_fds() copies everything it reads from one fd to several. When the
+ * input is a pipe the data never leaves the kernel: tee(2) duplicates the
+ * pipe's pages into every output but the last, and splice(2) then moves
+ * them into the last one, consuming the input. tee(2) only writes to pipes
+ * and may stop short when an output is full, so files and the rest of a
+ * short copy go through a private pipe that is tee'd from the input and
+ * spliced on. Outputs the kernel will not splice to (a terminal, a file
+ * opened O_APPEND) and inputs that are not pipes fall back to read/write.
+ *
+ * It serves the `tee` builtin and the `|>` fan-out operator. A fan-out
+ * consumer that exits early is simply dropped while the others go on; the
+ * builtin instead stops once its stdout is gone, as tee(1) does, rather
+ * than filling its files with input nobody downstream will read.
+ */
+
+typedef struct {
+    int fd;
+    int is_pipe;
+    int splice_ok;      /* cleared once the kernel refuses to splice to fd */
+    int alive;          /* cleared when the reader goes away or a write fails */
+    int vital;          /* its reader going away ends the whole copy */
+} sink_t;
+
+static int null_fd = -1;        /* where a dropped sink's share of the input goes */
+static int write_failed;
+static int stopped;             /* a vital sink was dropped */
+
+static int fd_is_pipe(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+static void drop(sink_t *s) {
+    if (errno != EPIPE) {
+        fprintf(stderr, "tee: write error: %s\n", strerror(errno));
+        write_failed = 1;
+    } else if (s->vital) {
+        write_failed = 1;
+    }
+    if (s->vital) stopped = 1;
+    s->alive = 0;
+}
+
+static int write_all(int fd, const char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, buf, n);
+        if (w == -1 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        buf += w;
+        n -= w;
+    }
+    return 0;
+}
+
+/* Consume exactly n bytes of pipe `from`, passing them to s while it is alive */
+static void drain_to(int from, sink_t *s, size_t n) {
+    char buf[16384];
+    while (n > 0) {
+        ssize_t m;
+        if (!s->alive || s->splice_ok) {
+            m = splice(from, NULL, s->alive ? s->fd : null_fd, NULL, n, SPLICE_F_MOVE);
+            if (m == -1 && errno == EINVAL && s->alive) { s->splice_ok = 0; continue; }
+            if (m == -1 && errno != EINTR && s->alive) { drop(s); continue; }
+        } else {
+            m = read(from, buf, n < sizeof(buf) ? n : sizeof(buf));
+            if (m > 0 && write_all(s->fd, buf, m) == -1) drop(s);
+        }
+        if (m > 0) n -= m;
+        else if (m == 0 || errno != EINTR) return;
+    }
+}
+
+/* Send the first n bytes of pipe in to s without consuming them */
+static void copy_to(int in, const int tmp[2], sink_t *s, size_t n) {
+    ssize_t sent = 0, held;
+    if (s->is_pipe) {
+        do sent = tee(in, s->fd, n, 0); while (sent == -1 && errno == EINTR);
+        if (sent == -1) { drop(s); return; }
+        if ((size_t)sent == n) return;
+    }
+    /* the private pipe is empty and as large as in, so it takes all n bytes */
+    do held = tee(in, tmp[1], n, 0); while (held == -1 && errno == EINTR);
+    if (held <= 0) { drop(s); return; }
+    sink_t skip = { .fd = -1 };
+    drain_to(tmp[0], &skip, sent);      /* what tee(2) already delivered */
+    drain_to(tmp[0], s, held - sent);
+}
+
+/* Input that is not a pipe: plain read/write */
+static void copy_loop(int in, sink_t *sinks, int n) {
+    char buf[65536];
+    ssize_t r;
+    while ((r = read(in, buf, sizeof(buf))) != 0) {
+        if (r == -1 && errno == EINTR) continue;
+        if (r == -1) { perror("tee: read"); write_failed = 1; return; }
+        int any = 0;
+        for (int k = 0; k < n; ++k) {
+            if (sinks[k].alive && write_all(sinks[k].fd, buf, r) == -1) drop(&sinks[k]);
+            any |= sinks[k].alive;
+        }
+        if (!any || stopped) return;
+    }
+}
+
+static void splice_loop(int in, sink_t *sinks, int n, const int tmp[2]) {
+    while (1) {
+        int last = -1;
+        for (int k = 0; k < n; ++k) {
+            if (sinks[k].alive) last = k;
+        }
+        if (last < 0 || stopped) return;    /* every reader, or a vital one, is gone */
+
+        struct pollfd pfd = { .fd = in, .events = POLLIN };
+        if (poll(&pfd, 1, -1) == -1) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        int avail = 0;
+        if (ioctl(in, FIONREAD, &avail) == -1 || avail <= 0) return;   /* EOF */
+        for (int k = 0; k < last; ++k) {
+            if (sinks[k].alive) copy_to(in, tmp, &sinks[k], avail);
+        }
+        drain_to(in, &sinks[last], avail);
+    }
+}
+
+/* Copy in to every fd of outs until EOF, or until outs[vital] (if >= 0) loses its
+   reader; 0 on success, 1 if a read or write failed */
+int tee_fds(int in, const int *outs, int nout, int vital) {
+    sink_t *sinks = calloc(nout ? nout : 1, sizeof(sink_t));
+    for (int k = 0; k < nout; ++k) {
+        int fl = fcntl(outs[k], F_GETFL);
+        sinks[k].fd = outs[k];
+        sinks[k].is_pipe = fd_is_pipe(outs[k]);
+        sinks[k].splice_ok = fl == -1 || !(fl & O_APPEND);    /* splice(2) refuses O_APPEND */
+        sinks[k].alive = 1;
+        sinks[k].vital = k == vital;
+    }
+
+    /* a reader that exits early is dropped, not fatal (unless vital) */
+    struct sigaction ign = { .sa_handler = SIG_IGN }, old;
+    sigaction(SIGPIPE, &ign, &old);
+    write_failed = 0;
+    stopped = 0;
+
+    int tmp[2] = { -1, -1 };
+    if (null_fd < 0) null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (fd_is_pipe(in) && null_fd >= 0 && pipe2(tmp, O_CLOEXEC) == 0 &&
+        fcntl(tmp[1], F_SETPIPE_SZ, fcntl(in, F_GETPIPE_SZ)) != -1) {
+        splice_loop(in, sinks, nout, tmp);
+    } else {
+        copy_loop(in, sinks, nout);
+    }
+    if (tmp[0] >= 0) { close(tmp[0]); close(tmp[1]); }
+
+    sigaction(SIGPIPE, &old, NULL);
+    free(sinks);
+    return write_failed;
+}
+
+/* tee [-a] [file...]: copy stdin to stdout and every file */
+int tee_builtin(char **argv, int in_fd, FILE *out) {
+    int i = 1, append = 0, status = 0, n = 0;
+    if (argv[i] && strcmp(argv[i], "-a") == 0) { append = 1; i++; }
+    int nfiles = 0;
+    while (argv[i + nfiles]) nfiles++;
+
+    int *fds = malloc(sizeof(int) * (nfiles + 1));
+    for (int k = 0; k < nfiles; ++k) {
+        /* -a: O_APPEND, so lines other writers add meanwhile are kept; such files are written, not spliced */
+        int fd = open(argv[i + k], O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0644);
+        if (fd == -1) {
+            fprintf(stderr, "tee: %s: %s\n", argv[i + k], strerror(errno));
+            status = 1;
+            continue;
+        }
+        fds[n++] = fd;
+    }
+    fflush(out);
+    fds[n] = fileno(out);       /* last: it gets the consuming splice */
+    if (tee_fds(in_fd, fds, n + 1, n) != 0) status = 1;    /* stdout gone: stop */
+    for (int k = 0; k < n; ++k) close(fds[k]);
+    free(fds);
+    return status;
+}
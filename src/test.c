@@ -0,0 +1,193 @@
+#include "shell.h"
+#include <sys/stat.h>
+
+/*
+ * test EXPR / [ EXPR ]: file, string and integer checks evaluated in the
+ * shell, so `if [ -f x ]` or `while test $n -lt 10` launches nothing.
+ *
+ *   -e -f -d -L -h -p -S -b -c -s -r -w -x -u -g -k FILE
+ *   -n STR, -z STR, STR, -t FD
+ *   A = B, A == B, A != B, A < B, A > B (bytewise)
+ *   A -eq -ne -lt -le -gt -ge B (integers)
+ *   F1 -nt -ot -ef F2
+ *   ! EXPR, EXPR -a EXPR, EXPR -o EXPR, ( EXPR )
+ *
+ * Status 0 if true, 1 if false, 2 on a malformed expression.
+ */
+
+typedef struct {
+    char **argv;
+    int pos, end;       /* next word; one past the last */
+    int err;
+} test_t;
+
+static void test_error(test_t *t, const char *what, const char *word) {
+    if (!t->err) {
+        if (word) fprintf(stderr, "test: %s: %s\n", word, what);
+        else fprintf(stderr, "test: %s\n", what);
+    }
+    t->err = 1;
+}
+
+static int is_unary(const char *w) {
+    return w[0] == '-' && w[1] && !w[2] && strchr("edfLhpSbcsrwxugkntz", w[1]);
+}
+
+static int is_binary(const char *w) {
+    static const char *const ops[] = {
+        "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef", NULL
+    };
+    for (int i = 0; ops[i]; ++i) {
+        if (strcmp(w, ops[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static long long integer(test_t *t, const char *s) {
+    char *end;
+    while (isspace((unsigned char)*s)) s++;
+    errno = 0;
+    long long n = strtoll(s, &end, 10);
+    while (isspace((unsigned char)*end)) end++;
+    if (end == s || *end || errno) test_error(t, "integer expression expected", s);
+    return n;
+}
+
+static int unary(test_t *t, char op, const char *arg) {
+    struct stat st;
+    switch (op) {
+    case 'n': return arg[0] != '\0';
+    case 'z': return arg[0] == '\0';
+    case 't': return isatty((int)integer(t, arg));
+    case 'r': return access(arg, R_OK) == 0;
+    case 'w': return access(arg, W_OK) == 0;
+    case 'x': return access(arg, X_OK) == 0;
+    case 'L': case 'h': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (stat(arg, &st) != 0) return 0;
+    switch (op) {
+    case 'e': return 1;
+    case 'f': return S_ISREG(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'u': return (st.st_mode & S_ISUID) != 0;
+    case 'g': return (st.st_mode & S_ISGID) != 0;
+    case 'k': return (st.st_mode & S_ISVTX) != 0;
+    }
+    return 0;
+}
+
+/* path's mtime into *ts; -1 if it does not exist */
+static int mtime_of(const char *path, struct timespec *ts) {
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    *ts = st.st_mtim;
+    return 0;
+}
+
+static int binary(test_t *t, const char *a, const char *op, const char *b) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(a, b) == 0;
+    if (strcmp(op, "!=") == 0) return strcmp(a, b) != 0;
+    if (strcmp(op, "<") == 0) return strcmp(a, b) < 0;
+    if (strcmp(op, ">") == 0) return strcmp(a, b) > 0;
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0) {
+        struct timespec ta = { 0 }, tb = { 0 };     /* a missing file leaves its side unset */
+        int ha = mtime_of(a, &ta) == 0, hb = mtime_of(b, &tb) == 0;
+        if (strcmp(op, "-ot") == 0) {
+            struct timespec tmp = ta; ta = tb; tb = tmp;
+            int h = ha; ha = hb; hb = h;
+        }
+        if (!ha || !hb) return ha && !hb;   /* an existing file is newer than a missing one */
+        return ta.tv_sec > tb.tv_sec || (ta.tv_sec == tb.tv_sec && ta.tv_nsec > tb.tv_nsec);
+    }
+    if (strcmp(op, "-ef") == 0) {
+        struct stat sa, sb;
+        return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+    }
+    long long x = integer(t, a), y = integer(t, b);
+    if (strcmp(op, "-eq") == 0) return x == y;
+    if (strcmp(op, "-ne") == 0) return x != y;
+    if (strcmp(op, "-lt") == 0) return x < y;
+    if (strcmp(op, "-le") == 0) return x <= y;
+    if (strcmp(op, "-gt") == 0) return x > y;
+    return x >= y;      /* -ge */
+}
+
+static int test_or(test_t *t);
+
+/* A primary: ( EXPR ), a unary or binary check, or a lone string */
+static int test_primary(test_t *t) {
+    char **w = t->argv;
+    int left = t->end - t->pos;
+    if (left <= 0) {
+        test_error(t, "argument expected", NULL);
+        return 0;
+    }
+    const char *a = w[t->pos];
+    /* a binary operator in second place wins: `[ -n = -n ]`, `[ ( = ( ]` */
+    if (left >= 3 && is_binary(w[t->pos + 1])) {
+        t->pos += 3;
+        return binary(t, a, w[t->pos - 2], w[t->pos - 1]);
+    }
+    if (strcmp(a, "(") == 0 && left >= 2) {
+        t->pos++;
+        int r = test_or(t);
+        if (t->pos >= t->end || strcmp(w[t->pos], ")") != 0) test_error(t, "')' expected", NULL);
+        else t->pos++;
+        return r;
+    }
+    if (is_unary(a) && left >= 2) {
+        t->pos += 2;
+        return unary(t, a[1], w[t->pos - 1]);
+    }
+    t->pos++;
+    return a[0] != '\0';
+}
+
+static int test_not(test_t *t) {
+    int left = t->end - t->pos;
+    /* `[ ! = x ]` compares "!" with "x" */
+    if (left > 1 && strcmp(t->argv[t->pos], "!") == 0 && !(left >= 3 && is_binary(t->argv[t->pos + 1]))) {
+        t->pos++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static int test_and(test_t *t) {
+    int r = test_not(t);
+    while (!t->err && t->pos < t->end && strcmp(t->argv[t->pos], "-a") == 0) {
+        t->pos++;
+        r = test_not(t) && r;
+    }
+    return r;
+}
+
+static int test_or(test_t *t) {
+    int r = test_and(t);
+    while (!t->err && t->pos < t->end && strcmp(t->argv[t->pos], "-o") == 0) {
+        t->pos++;
+        r = test_and(t) || r;
+    }
+    return r;
+}
+
+int test_builtin(char **argv) {
+    test_t t = { .argv = argv, .pos = 1 };
+    while (argv[t.end]) t.end++;
+    if (strcmp(argv[0], "[") == 0) {
+        if (t.end < 2 || strcmp(argv[t.end - 1], "]") != 0) {
+            fprintf(stderr, "[: missing ']'\n");
+            return 2;
+        }
+        t.end--;
+    }
+    if (t.pos == t.end) return 1;   /* no expression: false */
+    int r = test_or(&t);
+    if (!t.err && t.pos < t.end) test_error(&t, "unexpected argument", argv[t.pos]);
+    return t.err ? 2 : !r;
+}
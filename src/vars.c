@@ -1,99 +1,658 @@
 #include "shell.h"
 
-/* Simple linked list of key=value pairs */
-typedef struct var_s {
-    char *name;
+/*
+ * Shell variables: open-addressing hash table (linear probing, power-of-two
+ * capacity, kept under 70% load). Lookups return borrowed pointers into the
+ * table, so expansion copies each value once, straight into its output.
+ *
+ * Functions layer two things on top. Positional parameters ($1, $#, $@...)
+ * are a borrowed argv swapped in for the length of a call. `local NAME`
+ * saves the variable's current value on a stack of scopes, one per active
+ * call, and the value comes back when the call returns; the table itself
+ * only ever holds the innermost values, so lookups cost the same at any
+ * depth.
+ */
+
+#define VARS_INIT_CAP 64
+
+typedef struct {
+    char *name;     /* NULL = empty slot */
     char *value;
-    struct var_s *next;
+    unsigned long hash;
 } var_t;
 
-static var_t *vars_head = NULL;
+static var_t *vars = NULL;
+static size_t vars_cap = 0;
+static size_t vars_used = 0;
+static unsigned long vars_gen = 0;  /* bumped when a name is added or removed */
+
+static char **params = NULL;    /* $0 $1 ...; NULL-terminated, borrowed */
+
+typedef struct {
+    char *name;
+    char *value;        /* NULL: was unset */
+    int scope;
+} saved_var_t;
+
+static saved_var_t *saved = NULL;   /* what `local` replaced, innermost last */
+static int nsaved = 0, saved_cap = 0;
+static int scope = 0;               /* function calls active */
+
+static unsigned long hash_name(const char *s, size_t n) {
+    unsigned long h = 1469598103934665603UL;  /* FNV-1a */
+    for (size_t i = 0; i < n; ++i) { h ^= (unsigned char)s[i]; h *= 1099511628211UL; }
+    return h;
+}
+
+/* Find the slot holding name[0..n), or the empty slot where it would go */
+static var_t *find_slot(const char *name, size_t n, unsigned long h) {
+    size_t i = h & (vars_cap - 1);
+    while (vars[i].name) {
+        if (vars[i].hash == h && strncmp(vars[i].name, name, n) == 0 && vars[i].name[n] == '\0')
+            return &vars[i];
+        i = (i + 1) & (vars_cap - 1);
+    }
+    return &vars[i];
+}
+
+static void grow_table(void) {
+    size_t old_cap = vars_cap;
+    var_t *old = vars;
+    vars_cap = old_cap ? old_cap * 2 : VARS_INIT_CAP;
+    vars = calloc(vars_cap, sizeof(var_t));
+    for (size_t i = 0; i < old_cap; ++i) {
+        if (!old[i].name) continue;
+        size_t j = old[i].hash & (vars_cap - 1);
+        while (vars[j].name) j = (j + 1) & (vars_cap - 1);
+        vars[j] = old[i];
+    }
+    free(old);
+}
 
 void set_var(const char *name, const char *value) {
     if (!name) return;
     /* validate name: start with letter or underscore, then letters/digits/_ */
     if (!((isalpha((unsigned char)name[0]) || name[0] == '_'))) return;
 
-    /* search existing */
-    var_t *cur = vars_head;
-    while (cur) {
-        if (strcmp(cur->name, name) == 0) {
-            free(cur->value);
-            cur->value = strdup(value ? value : "");
-            return;
+    if ((vars_used + 1) * 10 > vars_cap * 7) grow_table();
+
+    size_t n = strlen(name);
+    unsigned long h = hash_name(name, n);
+    var_t *v = find_slot(name, n, h);
+    if (v->name) {
+        char *old = v->value;   /* value may be borrowed from this very slot */
+        v->value = strdup(value ? value : "");
+        free(old);
+        return;
+    }
+    v->name = strdup(name);
+    v->value = strdup(value ? value : "");
+    v->hash = h;
+    vars_used++;
+    vars_gen++;
+}
+
+void unset_var(const char *name) {
+    if (!vars || !name) return;
+    size_t n = strlen(name);
+    var_t *v = find_slot(name, n, hash_name(name, n));
+    if (!v->name) return;
+    free(v->name);
+    free(v->value);
+    vars_used--;
+    vars_gen++;
+    /* shift later entries of the probe run back into the hole (no tombstones) */
+    size_t i = v - vars, j = i;
+    vars[i].name = NULL;
+    vars[i].value = NULL;
+    while (1) {
+        j = (j + 1) & (vars_cap - 1);
+        if (!vars[j].name) break;
+        size_t home = vars[j].hash & (vars_cap - 1);
+        if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+            vars[i] = vars[j];
+            vars[j].name = NULL;
+            vars[j].value = NULL;
+            i = j;
         }
-        cur = cur->next;
     }
+}
 
-    var_t *n = malloc(sizeof(var_t));
-    n->name = strdup(name);
-    n->value = strdup(value ? value : "");
-    n->next = vars_head;
-    vars_head = n;
+/* Borrowed lookup of name[0..n); valid until the variable is next set */
+static const char *lookup(const char *name, size_t n) {
+    if (!vars) return NULL;
+    var_t *v = find_slot(name, n, hash_name(name, n));
+    return v->name ? v->value : NULL;
 }
 
-char *get_var(const char *name) {
+const char *get_var(const char *name) {
     if (!name) return NULL;
-    var_t *cur = vars_head;
-    while (cur) {
-        if (strcmp(cur->name, name) == 0) {
-            return strdup(cur->value); /* caller frees */
-        }
-        cur = cur->next;
+    return lookup(name, strlen(name));
+}
+
+size_t var_count(void) {
+    return vars_used;
+}
+
+unsigned long var_generation(void) {
+    return vars_gen;
+}
+
+/* Name of the next variable at or after *slot, advancing it; NULL at the end */
+const char *var_next(size_t *slot) {
+    while (*slot < vars_cap) {
+        const var_t *v = &vars[(*slot)++];
+        if (v->name) return v->name;
     }
     return NULL;
 }
 
-void print_vars(void) {
-    var_t *cur = vars_head;
-    if (!cur) { printf("No variables defined.\n"); return; }
-    while (cur) {
-        printf("%s=%s\n", cur->name, cur->value);
-        cur = cur->next;
+static int cmp_var_name(const void *a, const void *b) {
+    return strcmp((*(const var_t * const *)a)->name, (*(const var_t * const *)b)->name);
+}
+
+void print_vars(FILE *out) {
+    if (vars_used == 0) { fprintf(out, "No variables defined.\n"); return; }
+    /* print sorted by name so output does not depend on table layout */
+    const var_t **list = malloc(sizeof(var_t *) * vars_used);
+    size_t k = 0;
+    for (size_t i = 0; i < vars_cap; ++i) {
+        if (vars[i].name) list[k++] = &vars[i];
     }
+    qsort(list, k, sizeof(var_t *), cmp_var_name);
+    for (size_t i = 0; i < k; ++i) fprintf(out, "%s=%s\n", list[i]->name, list[i]->value);
+    free(list);
 }
 
 void free_vars(void) {
-    var_t *cur = vars_head;
-    while (cur) {
-        var_t *next = cur->next;
-        free(cur->name);
-        free(cur->value);
-        free(cur);
-        cur = next;
-    }
-    vars_head = NULL;
-}
-
-/* Expand argv in-place: for each arg that starts with $, replace with variable value (or empty string if undefined).
-   Support forms: $VARNAME and ${VARNAME} */
-void expand_argv_inplace(char **argv) {
-    if (!argv) return;
-    for (int i = 0; argv[i] != NULL; ++i) {
-        char *a = argv[i];
-        if (a[0] != '$') continue;
-
-        char *varname = NULL;
-        if (a[1] == '{') {
-            /* ${NAME} */
-            char *end = strchr(a + 2, '}');
-            if (!end) continue;
-            int len = end - (a + 2);
-            varname = malloc(len + 1);
-            strncpy(varname, a + 2, len);
-            varname[len] = '\0';
+    for (size_t i = 0; i < vars_cap; ++i) {
+        free(vars[i].name);
+        free(vars[i].value);
+    }
+    free(vars);
+    vars = NULL;
+    vars_cap = 0;
+    vars_used = 0;
+    vars_gen++;
+}
+
+char **set_params(char **argv) {
+    char **old = params;
+    params = argv;
+    return old;
+}
+
+static int param_count(void) {
+    int n = 0;
+    if (params && params[0]) while (params[n + 1]) n++;
+    return n;
+}
+
+void push_locals(void) {
+    scope++;
+}
+
+void pop_locals(void) {
+    while (nsaved > 0 && saved[nsaved - 1].scope == scope) {
+        saved_var_t *s = &saved[--nsaved];
+        if (s->value) set_var(s->name, s->value);
+        else unset_var(s->name);
+        free(s->name);
+        free(s->value);
+    }
+    scope--;
+}
+
+/* local NAME[=VALUE]...: NAME gets its old value back when the function returns */
+int local_builtin(char **argv) {
+    if (scope == 0) {
+        fprintf(stderr, "local: can only be used in a function\n");
+        return 1;
+    }
+    int status = 0;
+    for (int i = 1; argv[i]; ++i) {
+        const char *eq = strchr(argv[i], '=');
+        size_t n = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+        char *name = strndup(argv[i], n);
+        int ok = n > 0 && (isalpha((unsigned char)name[0]) || name[0] == '_');
+        for (size_t k = 1; ok && k < n; ++k) ok = isalnum((unsigned char)name[k]) || name[k] == '_';
+        if (!ok) {
+            fprintf(stderr, "local: %s: not a valid name\n", argv[i]);
+            free(name);
+            status = 1;
+            continue;
+        }
+        int known = 0;      /* already local in this call: keep the first saved value */
+        for (int k = nsaved - 1; k >= 0 && saved[k].scope == scope && !known; --k)
+            known = strcmp(saved[k].name, name) == 0;
+        if (!known) {
+            if (nsaved == saved_cap) {
+                saved_cap = saved_cap ? saved_cap * 2 : 16;
+                saved = realloc(saved, sizeof(saved_var_t) * saved_cap);
+            }
+            const char *old = get_var(name);
+            saved[nsaved].name = strdup(name);
+            saved[nsaved].value = old ? strdup(old) : NULL;
+            saved[nsaved].scope = scope;
+            nsaved++;
+        }
+        if (eq) set_var(name, eq + 1);
+        else unset_var(name);
+        free(name);
+    }
+    return status;
+}
+
+/* Growable output buffer for one word; starts on the stack */
+typedef struct {
+    char *s;
+    size_t len;
+    size_t cap;
+    char local[256];
+} strbuf_t;
+
+static void sb_init(strbuf_t *b) {
+    b->s = b->local;
+    b->len = 0;
+    b->cap = sizeof(b->local);
+}
+
+static void sb_append(strbuf_t *b, const char *s, size_t n) {
+    if (b->len + n + 1 > b->cap) {
+        size_t ncap = b->cap * 2;
+        while (b->len + n + 1 > ncap) ncap *= 2;
+        if (b->s == b->local) {
+            b->s = malloc(ncap);
+            memcpy(b->s, b->local, b->len);
         } else {
-            /* $NAME (upto end) */
-            varname = strdup(a + 1);
+            b->s = realloc(b->s, ncap);
         }
+        b->cap = ncap;
+    }
+    memcpy(b->s + b->len, s, n);
+    b->len += n;
+}
+
+static void sb_putc(strbuf_t *b, char c) {
+    sb_append(b, &c, 1);
+}
 
-        char *val = get_var(varname); /* malloc'd or NULL */
-        free(varname);
-        free(argv[i]);
-        if (val) {
-            argv[i] = val; /* use value (caller will free later) */
+/* Move the finished word into the arena */
+static char *sb_finish(arena_t *a, strbuf_t *b) {
+    char *r = arena_strndup(a, b->s, b->len);
+    if (b->s != b->local) free(b->s);
+    return r;
+}
+
+static int is_name_start(char c) { return isalpha((unsigned char)c) || c == '_'; }
+static int is_name_char(char c) { return isalnum((unsigned char)c) || c == '_'; }
+
+/* $N, or NULL past the last parameter */
+static const char *positional(long i) {
+    if (i == 0) return params && params[0] ? params[0] : "myshell";
+    return i <= param_count() ? params[i] : NULL;
+}
+
+/* $@ / $* outside a place where they make separate words: joined by spaces */
+static void append_params(strbuf_t *b) {
+    for (int i = 1, n = param_count(); i <= n; ++i) {
+        if (i > 1) sb_putc(b, ' ');
+        sb_append(b, params[i], strlen(params[i]));
+    }
+}
+
+/* Expand the $ reference at *pp (which points at '$') into b; advances *pp */
+static void expand_dollar(strbuf_t *b, const char **pp) {
+    const char *p = *pp + 1;
+    if (*p == '{') {
+        const char *end = strchr(p + 1, '}');
+        if (!end) { sb_putc(b, '$'); *pp = p; return; }   /* unterminated: keep literal */
+        const char *val;
+        if (isdigit((unsigned char)p[1])) val = positional(strtol(p + 1, NULL, 10));     /* ${10} */
+        else val = lookup(p + 1, end - (p + 1));
+        if (val) sb_append(b, val, strlen(val));
+        *pp = end + 1;
+        return;
+    }
+    if (*p == '?' || *p == '#') {
+        char num[16];
+        int n = snprintf(num, sizeof(num), "%d", *p == '?' ? last_status : param_count());
+        sb_append(b, num, n);
+        *pp = p + 1;
+        return;
+    }
+    if (isdigit((unsigned char)*p)) {
+        const char *val = positional(*p - '0');
+        if (val) sb_append(b, val, strlen(val));
+        *pp = p + 1;
+        return;
+    }
+    if (*p == '@' || *p == '*') {
+        append_params(b);
+        *pp = p + 1;
+        return;
+    }
+    if (is_name_start(*p)) {
+        const char *start = p;
+        while (is_name_char(*p)) p++;
+        const char *val = lookup(start, p - start);
+        if (val) sb_append(b, val, strlen(val));
+        *pp = p;
+        return;
+    }
+    sb_putc(b, '$');    /* lone '$' is literal */
+    *pp = p;
+}
+
+/* Fields of one word under construction: unquoted $(...) output is split on blanks */
+typedef struct {
+    char **v;
+    int n, cap;
+    int started;        /* the current field exists, even if empty (e.g. "") */
+    int glob;           /* quote what must not act as a wildcard with '\\' */
+} fields_t;
+
+static void field_end(arena_t *a, strbuf_t *b, fields_t *f) {
+    if (f->n + 1 >= f->cap) {
+        int ncap = f->cap ? f->cap * 2 : 8;
+        char **nv = arena_alloc(a, sizeof(char *) * ncap);
+        if (f->n) memcpy(nv, f->v, sizeof(char *) * f->n);
+        f->v = nv;
+        f->cap = ncap;
+    }
+    f->v[f->n++] = arena_strndup(a, b->s, b->len);
+    b->len = 0;
+    f->started = 0;
+}
+
+#define GLOB_QUOTE "*?[\\"     /* what quoting must keep from acting as a wildcard */
+
+/* Backslash-quote every character of chars in b->s[start..) */
+static void sb_quote_from(strbuf_t *b, size_t start, const char *chars) {
+    size_t n = b->len - start, i = 0;
+    while (i < n && !strchr(chars, b->s[start + i])) i++;
+    if (i == n) return;
+    char *tail = malloc(n);
+    memcpy(tail, b->s + start, n);
+    b->len = start;
+    for (i = 0; i < n; ++i) {
+        if (strchr(chars, tail[i])) sb_putc(b, '\\');
+        sb_putc(b, tail[i]);
+    }
+    free(tail);
+}
+
+static int is_ifs(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+/* Append out[0..n) to b; every run of blanks in it ends the current field */
+static void split_fields(arena_t *a, strbuf_t *b, const char *out, size_t n, fields_t *f) {
+    for (size_t i = 0; i < n; ) {
+        if (is_ifs(out[i])) {
+            if (f->started) field_end(a, b, f);
+            while (i < n && is_ifs(out[i])) i++;
+        } else {
+            size_t j = i;
+            while (j < n && !is_ifs(out[j])) j++;
+            sb_append(b, out + i, j - i);
+            if (f->glob) sb_quote_from(b, b->len - (j - i), "\\");
+            f->started = 1;
+            i = j;
+        }
+    }
+}
+
+/* p at "$((": just past the matching "))", NULL if it is not arithmetic (e.g. `$((cmd) )`) */
+static const char *arith_end(const char *p) {
+    int depth = 0;
+    for (p += 3; *p; p++) {
+        if (*p == '(') depth++;
+        else if (*p == ')' && depth-- == 0) return p[1] == ')' ? p + 2 : NULL;
+    }
+    return NULL;
+}
+
+static char *expand(arena_t *a, const char *w, fields_t *f);
+
+static int expand_failed;       /* a $((...)) in the current expansion had an error */
+
+/* Evaluate the $((...)) at *pp, ending at end, into b; its $ references are expanded first */
+static void expand_arith(arena_t *a, strbuf_t *b, const char **pp, const char *end) {
+    const char *expr = expand(a, arena_strndup(a, *pp + 3, end - 2 - (*pp + 3)), NULL);
+    long long v;
+    *pp = end;
+    if (arith_eval(expr, &v) != 0) {    /* reported; the caller fails the whole expansion */
+        expand_failed = 1;
+        return;
+    }
+    char num[32];
+    sb_append(b, num, snprintf(num, sizeof(num), "%lld", v));
+}
+
+/*
+ * Run the substitution at *pp ("$(" or "`") and append its output to b,
+ * advancing *pp past it. With f set (unquoted), every run of blanks in the
+ * output ends the current field.
+ */
+static void expand_subst(arena_t *a, strbuf_t *b, const char **pp, fields_t *f) {
+    const char *p = *pp, *end = subst_end(p);
+    if (!end) {     /* unterminated: keep the rest literally */
+        sb_append(b, p, strlen(p));
+        *pp = p + strlen(p);
+        return;
+    }
+    char *cmd;
+    if (*p == '`') {
+        /* inside backquotes a backslash only escapes \ ` $ */
+        cmd = arena_alloc(a, end - p);
+        char *o = cmd;
+        for (const char *q = p + 1; q < end - 1; ++q) {
+            if (*q == '\\' && (q[1] == '\\' || q[1] == '`' || q[1] == '$')) q++;
+            *o++ = *q;
+        }
+        *o = '\0';
+    } else {
+        cmd = arena_strndup(a, p + 2, end - p - 3);
+    }
+    *pp = end;
+
+    size_t n;
+    const char *out = command_subst(a, cmd, &n);
+    if (!f) { sb_append(b, out, n); return; }
+    split_fields(a, b, out, n, f);
+}
+
+/* Unquoted $@ / $* at *pp: the parameters, split on blanks like $(...) output */
+static void expand_params(arena_t *a, strbuf_t *b, const char **pp, fields_t *f) {
+    strbuf_t all;
+    sb_init(&all);
+    append_params(&all);
+    split_fields(a, b, all.s, all.len, f);
+    if (all.s != all.local) free(all.s);
+    *pp += 2;
+}
+
+/*
+ * Expand one raw word in a single pass: quote removal, backslash escapes,
+ * $NAME / ${NAME}, the parameters $1 ${10} $# $@ $*, $((...)) and
+ * $(...) / `...` anywhere in the word (undefined names expand to nothing). With f set the
+ * result goes into f as fields, "$@" giving one per parameter; otherwise
+ * it is returned as one string.
+ */
+static char *expand(arena_t *a, const char *w, fields_t *f) {
+    if (f && strcmp(w, "\"$@\"") == 0 && param_count() == 0) return NULL;    /* no words at all */
+    strbuf_t b;
+    sb_init(&b);
+    if (f) f->started = 1;      /* only an unquoted substitution can leave it unset */
+    const char *p = w;
+    while (*p) {
+        size_t q0 = b.len;
+        const char *end;
+        if (*p == '\\') {
+            p++;
+            if (*p) sb_putc(&b, *p++);
+            if (f && f->glob) sb_quote_from(&b, q0, GLOB_QUOTE);
+        } else if (*p == '\'') {
+            const char *end = strchr(p + 1, '\'');
+            if (!end) end = p + strlen(p);
+            sb_append(&b, p + 1, end - (p + 1));
+            p = *end ? end + 1 : end;
+            if (f && f->glob) sb_quote_from(&b, q0, GLOB_QUOTE);
+        } else if (*p == '"') {
+            p++;
+            while (*p && *p != '"') {
+                /* inside "...", backslash only escapes \ " $ ` */
+                if (*p == '\\' && (p[1] == '\\' || p[1] == '"' || p[1] == '$' || p[1] == '`')) {
+                    sb_putc(&b, p[1]);
+                    p += 2;
+                } else if (*p == '$' && p[1] == '(' && p[2] == '(' && (end = arith_end(p))) {
+                    expand_arith(a, &b, &p, end);
+                } else if ((*p == '$' && p[1] == '(') || *p == '`') {
+                    expand_subst(a, &b, &p, NULL);
+                } else if (*p == '$' && p[1] == '@' && f) {
+                    /* "$@": every parameter is a word of its own */
+                    for (int i = 1, n = param_count(); i <= n; ++i) {
+                        if (i > 1) {
+                            if (f->glob) sb_quote_from(&b, q0, GLOB_QUOTE);
+                            field_end(a, &b, f);
+                            q0 = 0;
+                        }
+                        sb_append(&b, params[i], strlen(params[i]));
+                    }
+                    p += 2;
+                } else if (*p == '$') {
+                    expand_dollar(&b, &p);
+                } else {
+                    sb_putc(&b, *p++);
+                }
+            }
+            if (*p) p++;
+            if (f && f->glob) sb_quote_from(&b, q0, GLOB_QUOTE);
+            if (f) f->started = 1;
+        } else if (*p == '$' && p[1] == '(' && p[2] == '(' && (end = arith_end(p))) {
+            expand_arith(a, &b, &p, end);
+            if (f) f->started = 1;
+        } else if ((*p == '$' && p[1] == '(') || *p == '`') {
+            if (f && b.len == 0 && p == w) f->started = 0;
+            expand_subst(a, &b, &p, f);
+        } else if (f && *p == '$' && (p[1] == '@' || p[1] == '*')) {
+            if (b.len == 0 && p == w) f->started = 0;
+            expand_params(a, &b, &p, f);
+        } else if (*p == '$') {
+            expand_dollar(&b, &p);
+            if (f && f->glob) sb_quote_from(&b, q0, "\\");
+            if (f) f->started = 1;
+        } else {
+            /* copy the run of ordinary characters in one go */
+            size_t n = strcspn(p, "'\"\\$`");
+            sb_append(&b, p, n);
+            p += n;
+            if (f) f->started = 1;
+        }
+    }
+    if (!f) return sb_finish(a, &b);
+    if (f->started) field_end(a, &b, f);
+    if (b.s != b.local) free(b.s);
+    return NULL;
+}
+
+static char *expand_one(arena_t *a, const char *w) {
+    if (!strpbrk(w, "'\"\\$`")) return (char *)w;   /* nothing to do: borrow the raw word */
+    return expand(a, w, NULL);
+}
+
+/*
+ * The public expansions start with expand_failed clear and put back the
+ * caller's value when done: a $(...) being expanded runs commands that
+ * expand words of their own.
+ */
+static int begin_expansion(void) {
+    int outer = expand_failed;
+    expand_failed = 0;
+    return outer;
+}
+
+static int end_expansion(int outer) {
+    int failed = expand_failed;
+    expand_failed = outer;
+    return failed;
+}
+
+/* One word to one string (no field splitting); the result may borrow w. NULL if a $((...)) failed */
+char *expand_word(arena_t *a, const char *w) {
+    int outer = begin_expansion();
+    char *r = expand_one(a, w);
+    return end_expansion(outer) ? NULL : r;
+}
+
+/* Expand a here-document body: $ references, substitutions and backslash
+   before \ $ `; quotes are ordinary characters there */
+char *expand_heredoc(arena_t *a, const char *body) {
+    if (!strpbrk(body, "\\$`")) return (char *)body;
+
+    int outer = begin_expansion();
+    strbuf_t b;
+    sb_init(&b);
+    const char *p = body;
+    while (*p) {
+        const char *end;
+        if (*p == '\\' && (p[1] == '\\' || p[1] == '$' || p[1] == '`')) {
+            sb_putc(&b, p[1]);
+            p += 2;
+        } else if (*p == '$' && p[1] == '(' && p[2] == '(' && (end = arith_end(p))) {
+            expand_arith(a, &b, &p, end);
+        } else if ((*p == '$' && p[1] == '(') || *p == '`') {
+            expand_subst(a, &b, &p, NULL);
+        } else if (*p == '$') {
+            expand_dollar(&b, &p);
         } else {
-            argv[i] = strdup(""); /* undefined -> empty string */
+            size_t n = strcspn(p + 1, "\\$`") + 1;
+            sb_append(&b, p, n);
+            p += n;
+        }
+    }
+    char *r = sb_finish(a, &b);
+    return end_expansion(outer) ? NULL : r;
+}
+
+/*
+ * Expand argv into a new NULL-terminated array (*argc set). Words are
+ * expanded one for one, except that unquoted $(...) output and $@ are split
+ * into several words, or none, and a word with an unquoted *, ? or [ becomes
+ * the paths it matches. The array grows as needed: a glob over a large
+ * directory is not limited to any fixed argument count. NULL if a $((...))
+ * failed: the command must not run with that word missing.
+ */
+char **expand_argv(arena_t *a, char **argv, int *argc) {
+    int outer = begin_expansion();
+    int n = 0;
+    while (argv[n]) n++;
+    char **out = arena_alloc(a, sizeof(char *) * (n + 1));
+    int k = 0, cap = n + 1;
+    for (int i = 0; i < n; ++i) {
+        const char *w = argv[i];
+        int glob = strpbrk(w, "*?[$") != NULL;  /* $X may hold a wildcard */
+        if (!glob && !strchr(w, '`') && !strstr(w, "$(")) {
+            out[k++] = expand_one(a, w);
+            continue;
+        }
+        fields_t f = { .glob = glob };
+        expand(a, w, &f);
+        for (int j = 0; j < f.n; ++j) {
+            int m = 1;
+            char **words = glob ? glob_expand(a, f.v[j], &m) : &f.v[j];
+            if (k + m + (n - i) > cap) {
+                cap = (k + m + (n - i)) * 2;
+                char **grown = arena_alloc(a, sizeof(char *) * cap);
+                memcpy(grown, out, sizeof(char *) * k);
+                out = grown;
+            }
+            memcpy(out + k, words, sizeof(char *) * m);
+            k += m;
         }
     }
+    out[k] = NULL;
+    if (argc) *argc = k;
+    return end_expansion(outer) ? NULL : out;
 }